@@ -0,0 +1,969 @@
+// Benchmarks of clamp_cast, its bulk kernels and the alternatives. Compile with
+// optimizations, for example with ./compile-and-benchmark.sh . The results are
+// written to stdout as JSON. An optional argument only runs the benchmarks
+// whose name contains it. A second one sets the size of the input of the
+// streaming and file benchmarks in GiB, 1 by default.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "clamp-cast-analyzed.hpp"
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast-file.hpp"
+#include "clamp-cast-parallel.hpp"
+#include "clamp-cast-pipeline.hpp"
+#include "clamp-cast-ring.hpp"
+#include "clamp-cast-stream.hpp"
+#include "clamp-cast-tune.hpp"
+#include "clamp-cast.hpp"
+
+#ifdef CLAMP_CAST_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCHMARK_CYCLES
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BENCHMARK_PERF_EVENTS
+#endif
+
+// Prevents the compiler from optimizing away the computation of value.
+template <typename T> void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Returns value without the compiler knowing what it is.
+template <typename T> T opaque(T value) {
+  asm volatile("" : "+m"(value));
+  return value;
+}
+
+// Hardware performance counters of the benchmark thread in user space. Counters
+// that cannot be opened, for example because of perf_event_paranoid or inside
+// of containers, are left out.
+class perf_counters {
+public:
+  static constexpr int count{4};
+  static constexpr const char *names[count]{"core_cycles", "instructions",
+                                            "branch_misses", "l1d_misses"};
+
+#ifdef BENCHMARK_PERF_EVENTS
+  perf_counters() {
+    const uint64_t configs[count]{
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    for (int i{0}; i < count; ++i) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = i == 3 ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds_[i] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+  }
+
+  ~perf_counters() {
+    for (const int fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  bool available(const int i) const { return fds_[i] >= 0; }
+
+  void start() {
+    for (const int fd : fds_) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  // Stops counting and stores the counts of the available counters.
+  void stop(double (&counts)[count]) {
+    for (int i{0}; i < count; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for (int i{0}; i < count; ++i) {
+      uint64_t value{0};
+      if (fds_[i] >= 0 && read(fds_[i], &value, sizeof(value)) ==
+                              static_cast<ssize_t>(sizeof(value))) {
+        counts[i] = static_cast<double>(value);
+      } else {
+        counts[i] = NAN;
+      }
+    }
+  }
+
+private:
+  int fds_[count]{-1, -1, -1, -1};
+#else
+  bool available(int) const { return false; }
+  void start() {}
+  void stop(double (&counts)[count]) {
+    for (auto &c : counts) {
+      c = NAN;
+    }
+  }
+#endif
+};
+
+perf_counters counters;
+
+// The time and the hardware events per element of the fastest run. Cycles are
+// counted by the time stamp counter which ticks at a constant rate that is
+// close to the nominal frequency of the processor. Metrics without a counter
+// are NaN.
+struct timing {
+  double ns{INFINITY};
+  double cycles{NAN};
+  double events[perf_counters::count]{NAN, NAN, NAN, NAN};
+};
+
+// Runs f several times and returns the fastest run.
+template <typename F> timing measure(const size_t elements, F f) {
+  const auto per_element = [&](const double total) {
+    return total / static_cast<double>(elements);
+  };
+  timing best;
+  for (int run{0}; run < 10; ++run) {
+    double events[perf_counters::count];
+    counters.start();
+#ifdef BENCHMARK_CYCLES
+    const auto start_cycles = __rdtsc();
+#endif
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+#ifdef BENCHMARK_CYCLES
+    const auto cycles = static_cast<double>(__rdtsc() - start_cycles);
+#else
+    const double cycles{NAN};
+#endif
+    counters.stop(events);
+    const std::chrono::duration<double, std::nano> duration{end - start};
+    if (per_element(duration.count()) < best.ns) {
+      best.ns = per_element(duration.count());
+      best.cycles = per_element(cycles);
+      for (int i{0}; i < perf_counters::count; ++i) {
+        best.events[i] = per_element(events[i]);
+      }
+    }
+  }
+  return best;
+}
+
+struct result {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> labels;
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+std::vector<result> results;
+const char *filter{""};
+
+bool selected(const std::string &name) {
+  return name.find(filter) != std::string::npos;
+}
+
+// Adds the metrics <name>_ns, <name>_cycles and one for every available
+// hardware counter.
+void add_metrics(result &r, const std::string &name, const timing &t) {
+  r.metrics.emplace_back(name + "_ns", t.ns);
+  if (!std::isnan(t.cycles)) {
+    r.metrics.emplace_back(name + "_cycles", t.cycles);
+  }
+  for (int i{0}; i < perf_counters::count; ++i) {
+    if (!std::isnan(t.events[i])) {
+      r.metrics.emplace_back(name + "_" + perf_counters::names[i],
+                             t.events[i]);
+    }
+  }
+}
+
+void report(result r) {
+  std::cerr << r.name;
+  for (const auto &[metric, value] : r.metrics) {
+    std::cerr << " " << metric << "=" << value;
+  }
+  std::cerr << "\n";
+  results.push_back(std::move(r));
+}
+
+void write_json(std::ostream &stream) {
+  stream << "{\"telemetry\": "
+#ifdef CLAMP_CAST_TELEMETRY
+         << "true"
+#else
+         << "false"
+#endif
+         << ", \"counters\": [";
+  const char *separator{""};
+  for (int i{0}; i < perf_counters::count; ++i) {
+    if (counters.available(i)) {
+      stream << separator << "\"" << perf_counters::names[i] << "\"";
+      separator = ", ";
+    }
+  }
+  stream << "], \"benchmarks\": [";
+  separator = "";
+  for (const auto &r : results) {
+    stream << separator << "\n  {\"name\": \"" << r.name << "\"";
+    for (const auto &[label, value] : r.labels) {
+      stream << ", \"" << label << "\": \"" << value << "\"";
+    }
+    for (const auto &[metric, value] : r.metrics) {
+      stream << ", \"" << metric << "\": " << value;
+    }
+    stream << "}";
+    separator = ",";
+  }
+  stream << "\n]}\n";
+}
+
+template <typename To, typename From>
+std::vector<std::pair<std::string, std::string>>
+pair_labels(const std::string &kernel) {
+  return {{"from", clamp_cast::detail::type_name<From>()},
+          {"to", clamp_cast::detail::type_name<To>()},
+          {"kernel", kernel}};
+}
+
+// Values that every kernel converts without undefined behavior: in the range of
+// To and of long for std::lround.
+template <typename To, typename From>
+std::vector<From> in_range_values(const size_t n) {
+  const auto lower = std::max<From>(
+      clamp_cast::lower_bound_inclusive<To, From>(),
+      clamp_cast::lower_bound_inclusive<long, From>());
+  const auto upper = std::min<From>(
+      clamp_cast::upper_bound_exclusive<To, From>(),
+      clamp_cast::upper_bound_exclusive<long, From>());
+  std::mt19937_64 rng{0};
+  std::uniform_real_distribution<From> distribution{
+      lower * static_cast<From>(0.9), upper * static_cast<From>(0.9)};
+  std::vector<From> values(n);
+  for (auto &value : values) {
+    value = distribution(rng);
+  }
+  return values;
+}
+
+// Measures a conversion of one element by the latency of a chain of dependent
+// conversions and by the throughput of independent conversions.
+template <typename To, typename From, typename F>
+void benchmark_element(const std::string &kernel,
+                       const std::vector<From> &values, F convert) {
+  const std::string name{std::string{"convert/"} +
+                         clamp_cast::detail::type_name<From>() + "/" +
+                         clamp_cast::detail::type_name<To>() + "/" + kernel};
+  if (!selected(name)) {
+    return;
+  }
+  const size_t n{values.size()};
+  std::vector<To> out(n);
+  const auto latency = measure(n, [&] {
+    // Every input depends on the previous result through a multiplication
+    // with a zero that the compiler does not know about.
+    const To zero{opaque(To{0})};
+    To previous{0};
+    for (size_t i{0}; i < n; ++i) {
+      previous = convert(values[i] + static_cast<From>(previous * zero));
+    }
+    do_not_optimize(previous);
+  });
+  const auto throughput = measure(n, [&] {
+    for (size_t i{0}; i < n; ++i) {
+      out[i] = convert(values[i]);
+    }
+    do_not_optimize(out.data());
+  });
+  result r{name, pair_labels<To, From>(kernel), {}};
+  add_metrics(r, "latency", latency);
+  add_metrics(r, "throughput", throughput);
+  report(std::move(r));
+}
+
+// Measures a conversion of a whole array by its throughput.
+template <typename To, typename From, typename F>
+void benchmark_array(const std::string &kernel,
+                     const std::vector<From> &values, F convert) {
+  const std::string name{std::string{"convert/"} +
+                         clamp_cast::detail::type_name<From>() + "/" +
+                         clamp_cast::detail::type_name<To>() + "/" + kernel};
+  if (!selected(name)) {
+    return;
+  }
+  std::vector<To> out(values.size());
+  const auto throughput = measure(values.size(), [&] {
+    convert(values.data(), values.size(), out.data());
+    do_not_optimize(out.data());
+  });
+  result r{name, pair_labels<To, From>(kernel), {}};
+  add_metrics(r, "throughput", throughput);
+  report(std::move(r));
+}
+
+// Compares clamp_cast with the alternatives for one pair on in range data where
+// all of them are correct.
+template <typename To, typename From> void benchmark_pair() {
+  const auto values = in_range_values<To, From>(size_t{1} << 16);
+
+  benchmark_element<To, From>(
+      "clamp_cast", values, [](const From from) {
+        return clamp_cast::clamp_cast<To>(from);
+      });
+  benchmark_element<To, From>("static_cast", values, [](const From from) {
+    return static_cast<To>(from);
+  });
+  // These round instead of truncating and are only here for their speed.
+  benchmark_element<To, From>("lround", values, [](const From from) {
+    return static_cast<To>(std::lround(from));
+  });
+  benchmark_element<To, From>("lrint", values, [](const From from) {
+    return static_cast<To>(std::lrint(from));
+  });
+
+#ifdef CLAMP_CAST_SSE2
+  // The raw conversion instructions without any clamping.
+  if constexpr (std::is_same_v<To, int32_t> && std::is_same_v<From, float>) {
+    benchmark_array<To, From>(
+        "sse_cvttps", values, [](const float *in, size_t n, int32_t *out) {
+          for (size_t i{0}; i + 4 <= n; i += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                             _mm_cvttps_epi32(_mm_loadu_ps(in + i)));
+          }
+        });
+  } else if constexpr (std::is_same_v<To, int32_t> &&
+                       std::is_same_v<From, double>) {
+    benchmark_array<To, From>(
+        "sse_cvttpd", values, [](const double *in, size_t n, int32_t *out) {
+          for (size_t i{0}; i + 4 <= n; i += 4) {
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(out + i),
+                _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_loadu_pd(in + i)),
+                                   _mm_cvttpd_epi32(_mm_loadu_pd(in + i + 2))));
+          }
+        });
+  }
+#endif
+
+  benchmark_array<To, From>(
+      "clamp_cast_n/scalar", values, [](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::scalar>(in, n, out);
+      });
+  if constexpr (clamp_cast::has_simd_kernel<To, From>()) {
+    benchmark_array<To, From>(
+        "clamp_cast_n/simd", values, [](const From *in, size_t n, To *out) {
+          clamp_cast::clamp_cast_n<clamp_cast::engine::simd>(in, n, out);
+        });
+  }
+  benchmark_array<To, From>(
+      "clamp_cast_n/prescan", values, [](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::prescan>(in, n, out);
+      });
+  benchmark_array<To, From>(
+      "clamp_cast_n/tuned", values, [](const From *in, size_t n, To *out) {
+        clamp_cast::tune::clamp_cast_n(in, n, out);
+      });
+}
+
+template <typename From> void benchmark_pairs() {
+  benchmark_pair<int8_t, From>();
+  benchmark_pair<uint8_t, From>();
+  benchmark_pair<int16_t, From>();
+  benchmark_pair<uint16_t, From>();
+  benchmark_pair<int32_t, From>();
+  benchmark_pair<uint32_t, From>();
+  benchmark_pair<int64_t, From>();
+  benchmark_pair<uint64_t, From>();
+}
+
+void report_throughput(const std::string &name, const timing &throughput) {
+  result r{name, {}, {}};
+  add_metrics(r, "throughput", throughput);
+  report(std::move(r));
+}
+
+// A mix of inputs. The speed of the scalar kernels depends on how well the
+// branches for out of range values are predicted.
+struct scenario {
+  const char *name;
+  // The fractions of NaN and of out of range values which are split evenly
+  // between both sides.
+  double nan;
+  double overflow;
+  bool sorted;
+  // All values are within a few ULP of the bounds of the range of To.
+  bool boundary;
+};
+
+const scenario scenarios[]{
+    {"in_range", 0.0, 0.0, false, false},
+    {"nan_1", 0.01, 0.0, false, false},
+    {"nan_10", 0.1, 0.0, false, false},
+    {"nan_50", 0.5, 0.0, false, false},
+    {"overflow_1", 0.0, 0.01, false, false},
+    {"overflow_10", 0.0, 0.1, false, false},
+    {"overflow_50", 0.0, 0.5, false, false},
+    {"overflow_50_sorted", 0.0, 0.5, true, false},
+    {"boundary", 0.0, 0.0, false, true},
+};
+
+template <typename To, typename From>
+std::vector<From> scenario_values(const scenario &s, const size_t n) {
+  auto values = in_range_values<To, From>(n);
+  const auto lower = clamp_cast::lower_bound_inclusive<To, From>();
+  const auto upper = clamp_cast::upper_bound_exclusive<To, From>();
+  const auto infinity = std::numeric_limits<From>::infinity();
+  std::mt19937_64 rng{1};
+  std::uniform_real_distribution<From> unit{0, 1};
+  std::uniform_int_distribution<int> ulps{-16, 16};
+  for (auto &value : values) {
+    const auto u = unit(rng);
+    if (s.boundary) {
+      value = u < From{0.5} ? lower : upper;
+      const int k{ulps(rng)};
+      for (int i{0}; i < std::abs(k); ++i) {
+        value = std::nextafter(value, k < 0 ? -infinity : infinity);
+      }
+    } else if (u < s.nan) {
+      value = std::numeric_limits<From>::quiet_NaN();
+    } else if (u < s.nan + s.overflow) {
+      const auto distance = (upper - lower) * unit(rng);
+      value = unit(rng) < From{0.5} ? lower - 1 - distance : upper + distance;
+    }
+  }
+  if (s.sorted) {
+    std::sort(values.begin(), values.end());
+  }
+  return values;
+}
+
+// Measures every engine for one pair in every scenario.
+template <typename To, typename From> void benchmark_scenarios() {
+  for (const auto &s : scenarios) {
+    const std::string prefix{std::string{"scenario/"} +
+                             clamp_cast::detail::type_name<From>() + "/" +
+                             clamp_cast::detail::type_name<To>() + "/" +
+                             s.name + "/"};
+    if (!selected(prefix)) {
+      continue;
+    }
+    const auto values = scenario_values<To, From>(s, size_t{1} << 16);
+    std::vector<To> out(values.size());
+    const auto run = [&](const std::string &kernel, auto convert) {
+      result r{prefix + kernel, pair_labels<To, From>(kernel), {}};
+      r.labels.emplace_back("scenario", s.name);
+      add_metrics(r, "throughput", measure(values.size(), [&] {
+                    convert(values.data(), values.size(), out.data());
+                    do_not_optimize(out.data());
+                  }));
+      report(std::move(r));
+    };
+    run("clamp_cast_n/scalar", [](const From *in, size_t n, To *out) {
+      clamp_cast::clamp_cast_n<clamp_cast::engine::scalar>(in, n, out);
+    });
+    if constexpr (clamp_cast::has_simd_kernel<To, From>()) {
+      run("clamp_cast_n/simd", [](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::simd>(in, n, out);
+      });
+    }
+    run("clamp_cast_n/prescan", [](const From *in, size_t n, To *out) {
+      clamp_cast::clamp_cast_n<clamp_cast::engine::prescan>(in, n, out);
+    });
+  }
+}
+
+// Compares clamp_cast_n with adaptive_converter on streams that are quiet, that
+// clip all the time and that alternate between both every 64 blocks.
+// The adaptation only runs for pairs without a SIMD kernel or with another
+// policy than policy<>, so pairs with a kernel are measured with sticky.
+template <typename To, typename From, typename Policy = clamp_cast::policy<>>
+void benchmark_adaptive(const Policy &policy = {}, const char *name = "") {
+  constexpr size_t block{
+      clamp_cast::adaptive_converter<To, From, Policy>::block_size};
+  const size_t n{256 * block};
+  const auto quiet = scenario_values<To, From>(scenarios[0], n);
+  const auto clipping = scenario_values<To, From>(scenarios[6], n);
+  std::vector<From> bursts(n);
+  for (size_t i{0}; i < n; ++i) {
+    bursts[i] = (i / (64 * block)) % 2 == 0 ? quiet[i] : clipping[i];
+  }
+  const std::pair<const char *, const std::vector<From> *> streams[]{
+      {"quiet", &quiet}, {"clipping", &clipping}, {"bursts", &bursts}};
+  std::vector<To> out(n);
+  for (const auto &[stream, values] : streams) {
+    const std::string prefix{std::string{"adaptive/"} +
+                             clamp_cast::detail::type_name<From>() + "/" +
+                             clamp_cast::detail::type_name<To>() + "/" +
+                             name + stream + "/"};
+    if (selected(prefix + "clamp_cast_n")) {
+      report_throughput(prefix + "clamp_cast_n", measure(n, [&] {
+                          clamp_cast::clamp_cast_n(values->data(), n,
+                                                   out.data(), policy);
+                          do_not_optimize(out.data());
+                        }));
+    }
+    if (selected(prefix + "adaptive_converter")) {
+      clamp_cast::adaptive_converter<To, From, Policy> convert{policy};
+      report_throughput(prefix + "adaptive_converter", measure(n, [&] {
+                          convert(values->data(), n, out.data());
+                          do_not_optimize(out.data());
+                        }));
+    }
+  }
+}
+
+// Converts a column of features to several integer types like a feature store
+// does, with clamp_cast_n and with an analyzed_buffer. A quarter of the blocks
+// are large values that saturate int8 and int16 and a quarter are medium ones.
+template <typename To, typename From>
+void benchmark_analyzed_type(
+    const std::vector<From> &values,
+    const clamp_cast::analyzed_buffer<From> &analyzed) {
+  const std::string prefix{std::string{"analyzed/"} +
+                           clamp_cast::detail::type_name<From>() + "/" +
+                           clamp_cast::detail::type_name<To>() + "/"};
+  const size_t n{values.size()};
+  std::vector<To> out(n);
+  if (selected(prefix + "clamp_cast_n")) {
+    report_throughput(prefix + "clamp_cast_n", measure(n, [&] {
+                        clamp_cast::clamp_cast_n(values.data(), n, out.data());
+                        do_not_optimize(out.data());
+                      }));
+  }
+  if (selected(prefix + "analyzed_buffer")) {
+    report_throughput(prefix + "analyzed_buffer", measure(n, [&] {
+                        clamp_cast::clamp_cast_n(analyzed, out.data());
+                        do_not_optimize(out.data());
+                      }));
+  }
+}
+
+template <typename From> void benchmark_analyzed() {
+  constexpr size_t block{clamp_cast::analyzed_buffer<From>::block_size};
+  const size_t n{size_t{1} << 20};
+  std::vector<From> values(n);
+  std::mt19937_64 rng{2};
+  std::uniform_real_distribution<From> unit{0, 1};
+  for (size_t i{0}; i < n; ++i) {
+    const auto u = unit(rng);
+    switch (i / block % 4) {
+    case 2:
+      values[i] = From{100000} + From{100000} * u;
+      break;
+    case 3:
+      values[i] = From{10000} * (2 * u - 1);
+      break;
+    default:
+      values[i] = From{100} * (2 * u - 1);
+      break;
+    }
+  }
+  const std::string analyze{std::string{"analyzed/"} +
+                            clamp_cast::detail::type_name<From>() +
+                            "/analyze"};
+  if (selected(analyze)) {
+    report_throughput(analyze, measure(n, [&] {
+                        const clamp_cast::analyzed_buffer<From> analyzed{
+                            values.data(), n};
+                        do_not_optimize(analyzed.blocks().data());
+                      }));
+  }
+  const clamp_cast::analyzed_buffer<From> analyzed{values.data(), n};
+  benchmark_analyzed_type<int8_t>(values, analyzed);
+  benchmark_analyzed_type<int16_t>(values, analyzed);
+  benchmark_analyzed_type<int32_t>(values, analyzed);
+  benchmark_analyzed_type<int64_t>(values, analyzed);
+}
+
+// Converts an array much larger than the caches with parallel::clamp_cast_n on
+// 1, 2, 4, ... threads up to the number of hardware threads. The bandwidth is
+// the bytes read and written per second and stops growing when the memory is
+// saturated.
+template <typename To, typename From> void benchmark_parallel() {
+  const std::string prefix{std::string{"parallel/"} +
+                           clamp_cast::detail::type_name<From>() + "/" +
+                           clamp_cast::detail::type_name<To>() + "/"};
+  if (!selected(prefix)) {
+    return;
+  }
+  const size_t n{size_t{1} << 25};
+  const auto values = in_range_values<To, From>(n);
+  std::vector<To> out(n);
+  const unsigned hardware{std::max(1u, std::thread::hardware_concurrency())};
+  for (unsigned threads{1};; threads = std::min(2 * threads, hardware)) {
+    const std::string name{prefix + std::to_string(threads)};
+    if (selected(name)) {
+      clamp_cast::parallel::thread_pool pool{threads - 1};
+      const auto throughput = measure(n, [&] {
+        clamp_cast::parallel::clamp_cast_n(pool, values.data(), n, out.data());
+        do_not_optimize(out.data());
+      });
+      result r{name, pair_labels<To, From>("parallel"), {}};
+      r.labels.emplace_back("threads", std::to_string(threads));
+      add_metrics(r, "throughput", throughput);
+      r.metrics.emplace_back("bandwidth_gb_per_s",
+                             static_cast<double>(sizeof(From) + sizeof(To)) /
+                                 throughput.ns);
+      report(std::move(r));
+    }
+    if (threads == hardware) {
+      break;
+    }
+  }
+}
+
+// Converts an array of streaming_gib GiB with normal and with non-temporal
+// stores. The bandwidth is the bytes read and written per second.
+double streaming_gib{1};
+
+template <typename To, typename From> void benchmark_streaming() {
+  const std::string prefix{std::string{"streaming/"} +
+                           clamp_cast::detail::type_name<From>() + "/" +
+                           clamp_cast::detail::type_name<To>() + "/"};
+  if (!selected(prefix)) {
+    return;
+  }
+  const auto n = static_cast<size_t>(streaming_gib * (1 << 30)) / sizeof(From);
+  std::vector<From> values(n);
+  for (size_t i{0}; i < n; ++i) {
+    values[i] = static_cast<From>(i % 1000);
+  }
+  std::vector<To> out(n);
+  const auto run = [&](const std::string &kernel, auto convert) {
+    if (!selected(prefix + kernel)) {
+      return;
+    }
+    const auto throughput = measure(n, [&] {
+      convert(values.data(), n, out.data());
+      do_not_optimize(out.data());
+    });
+    result r{prefix + kernel, pair_labels<To, From>(kernel), {}};
+    add_metrics(r, "throughput", throughput);
+    r.metrics.emplace_back("bandwidth_gb_per_s",
+                           static_cast<double>(sizeof(From) + sizeof(To)) /
+                               throughput.ns);
+    report(std::move(r));
+  };
+  run("clamp_cast_n", [](const From *in, size_t count, To *to) {
+    clamp_cast::clamp_cast_n(in, count, to);
+  });
+  run("clamp_cast_n/streaming", [](const From *in, size_t count, To *to) {
+    clamp_cast::clamp_cast_n<clamp_cast::engine::streaming>(in, count, to);
+  });
+}
+
+#ifdef __linux__
+// Converts a file of streaming_gib GiB with file::convert, which maps the
+// files, and with file::convert_pipelined on io_uring and on threads. The files
+// stay in the page cache between the runs so this compares the cost of the
+// mappings with that of the copies. The difference on cold files shows with
+// ./compile-and-convert.sh after dropping the caches.
+template <typename To, typename From> void benchmark_file() {
+  const std::string prefix{std::string{"file/"} +
+                           clamp_cast::detail::type_name<From>() + "/" +
+                           clamp_cast::detail::type_name<To>() + "/"};
+  if (!selected(prefix)) {
+    return;
+  }
+  const std::string name{"/tmp/clamp-cast-benchmark-" +
+                         std::to_string(getpid())};
+  const std::string input{name + ".in"};
+  const std::string output{name + ".out"};
+  const auto n = static_cast<size_t>(streaming_gib * (1 << 30)) / sizeof(From);
+  {
+    const auto values = in_range_values<To, From>(n);
+    std::ofstream{input, std::ios::binary}.write(
+        reinterpret_cast<const char *>(values.data()),
+        static_cast<std::streamsize>(n * sizeof(From)));
+  }
+  const auto run = [&](const std::string &io, auto convert) {
+    if (!selected(prefix + io)) {
+      return;
+    }
+    const auto throughput = measure(n, convert);
+    result r{prefix + io, pair_labels<To, From>("file"), {}};
+    r.labels.emplace_back("io", io);
+    add_metrics(r, "throughput", throughput);
+    r.metrics.emplace_back("bandwidth_gb_per_s",
+                           static_cast<double>(sizeof(From) + sizeof(To)) /
+                               throughput.ns);
+    report(std::move(r));
+  };
+  run("mmap", [&] {
+    clamp_cast::file::convert<To, From>(input.c_str(), output.c_str());
+  });
+  clamp_cast::file::pipeline_options pipeline;
+  const auto run_pipeline = [&](const std::string &io,
+                                const clamp_cast::file::io backend) {
+    pipeline.backend = backend;
+    run(io, [&] {
+      clamp_cast::file::convert_pipelined<To, From>(
+          input.c_str(), output.c_str(), {}, pipeline);
+    });
+  };
+  if (clamp_cast::file::uring_available()) {
+    run_pipeline("uring", clamp_cast::file::io::uring);
+  }
+  run_pipeline("threads", clamp_cast::file::io::threads);
+  std::remove(input.c_str());
+  std::remove(output.c_str());
+}
+#endif
+
+// Converts a stream in chunks of a few sizes with clamp_cast_n per chunk and
+// with stream_converter, which converts the ends of the chunks as vectors,
+// into the same output array.
+template <typename To, typename From> void benchmark_stream() {
+  const size_t n{size_t{1} << 20};
+  const auto values = in_range_values<To, From>(n);
+  // Room for the elements that push can store past the end.
+  std::vector<To> out(n + 64);
+  for (const size_t chunk : {size_t{13}, size_t{100}, size_t{1000}}) {
+    const std::string prefix{std::string{"stream/"} +
+                             clamp_cast::detail::type_name<From>() + "/" +
+                             clamp_cast::detail::type_name<To>() + "/" +
+                             std::to_string(chunk) + "/"};
+    if (selected(prefix + "clamp_cast_n")) {
+      report_throughput(prefix + "clamp_cast_n", measure(n, [&] {
+                          for (size_t i{0}; i < n; i += chunk) {
+                            clamp_cast::clamp_cast_n(values.data() + i,
+                                                     std::min(chunk, n - i),
+                                                     out.data() + i);
+                          }
+                          do_not_optimize(out.data());
+                        }));
+    }
+    if (selected(prefix + "stream_converter")) {
+      clamp_cast::stream_converter<To, From> stream;
+      report_throughput(prefix + "stream_converter", measure(n, [&] {
+                          To *to{out.data()};
+                          for (size_t i{0}; i < n; i += chunk) {
+                            to = stream
+                                     .push({values.data() + i,
+                                            std::min(chunk, n - i)},
+                                           to)
+                                     .end();
+                          }
+                          const auto rest = stream.flush();
+                          std::copy(rest.begin(), rest.end(), to);
+                          do_not_optimize(out.data());
+                        }));
+    }
+  }
+}
+
+// The latency from pushing a frame into a conversion_ring until the consumer
+// thread has received all of it. The producer sends a frame after the previous
+// one has been received so that the frames do not queue up.
+template <typename To, typename From> void benchmark_ring(const size_t frame) {
+  const std::string name{std::string{"ring/"} +
+                         clamp_cast::detail::type_name<From>() + "/" +
+                         clamp_cast::detail::type_name<To>() + "/" +
+                         std::to_string(frame)};
+  if (!selected(name)) {
+    return;
+  }
+  using clock = std::chrono::steady_clock;
+  constexpr size_t frames{20000};
+  clamp_cast::conversion_ring<To, From> ring{4 * frame};
+  const auto values = in_range_values<To, From>(frame);
+  std::vector<clock::time_point> sent(frames);
+  std::vector<clock::time_point> received(frames);
+  std::atomic<size_t> done{0};
+  std::thread consumer{[&] {
+    // Reads the values in place.
+    long sum{0};
+    for (size_t f{0}; f < frames; ++f) {
+      for (size_t count{0}; count < frame;) {
+        const auto front = ring.front();
+        if (front.empty()) {
+          std::this_thread::yield();
+        }
+        for (const auto value : front) {
+          sum += value;
+        }
+        ring.pop(front.size());
+        count += front.size();
+      }
+      received[f] = clock::now();
+      done.store(f + 1, std::memory_order_release);
+    }
+    do_not_optimize(sum);
+  }};
+  for (size_t f{0}; f < frames; ++f) {
+    while (done.load(std::memory_order_acquire) != f) {
+      std::this_thread::yield();
+    }
+    sent[f] = clock::now();
+    for (size_t count{0}; count < frame;) {
+      count += ring.push(values.data() + count, frame - count);
+    }
+  }
+  consumer.join();
+
+  std::vector<double> latencies(frames);
+  for (size_t f{0}; f < frames; ++f) {
+    latencies[f] =
+        std::chrono::duration<double, std::nano>{received[f] - sent[f]}
+            .count();
+  }
+  std::sort(latencies.begin(), latencies.end());
+  result r{name, pair_labels<To, From>("conversion_ring"), {}};
+  r.labels.emplace_back("frame", std::to_string(frame));
+  const std::pair<const char *, double> quantiles[]{{"latency_p50_ns", 0.5},
+                                                     {"latency_p99_ns", 0.99},
+                                                     {"latency_p999_ns", 0.999},
+                                                     {"latency_max_ns", 1.0}};
+  for (const auto &[metric, quantile] : quantiles) {
+    const auto index = static_cast<size_t>(quantile * (frames - 1));
+    r.metrics.emplace_back(metric, latencies[index]);
+  }
+  report(std::move(r));
+}
+
+// Evaluates `CAST(x AS INT32) BETWEEN low AND high` on a float column by
+// converting every element and by comparing with a precomputed interval.
+void benchmark_cast_interval() {
+  const size_t n{size_t{1} << 20};
+  std::vector<float> values(n);
+  std::mt19937 rng{0};
+  std::uniform_real_distribution<float> distribution{-1e6f, 1e6f};
+  for (auto &value : values) {
+    value = distribution(rng);
+  }
+  std::vector<uint64_t> selection((n + 63) / 64);
+  const int32_t low{-1000};
+  const int32_t high{1000};
+  const auto mode = clamp_cast::rounding::to_nearest;
+
+  if (selected("cast_interval/convert")) {
+    report_throughput("cast_interval/convert", measure(n, [&] {
+                        for (size_t w{0}; w < selection.size(); ++w) {
+                          uint64_t word{0};
+                          for (size_t i{0}; i < 64; ++i) {
+                            const auto to = clamp_cast::clamp_cast<int32_t>(
+                                std::nearbyint(values[w * 64 + i]));
+                            word |= uint64_t{low <= to && to <= high} << i;
+                          }
+                          selection[w] = word;
+                        }
+                        do_not_optimize(selection.data());
+                      }));
+  }
+
+  if (selected("cast_interval/filter_in")) {
+    report_throughput("cast_interval/filter_in", measure(n, [&] {
+                        const auto range =
+                            clamp_cast::cast_interval<int32_t, float>(
+                                low, high, mode);
+                        clamp_cast::filter_in(values.data(), n, range,
+                                              selection.data());
+                        do_not_optimize(selection.data());
+                      }));
+  }
+}
+
+// Measures the overhead of reporting saturated elements with the sticky policy
+// and checked_clamp_cast_n compared to clamp_cast_n on in range data.
+void benchmark_checked() {
+  const size_t n{size_t{1} << 20};
+  const auto values = in_range_values<int16_t, float>(n);
+  std::vector<int16_t> out(n);
+  std::vector<uint64_t> selection((n + 63) / 64);
+
+  if (selected("checked/clamp_cast_n")) {
+    report_throughput("checked/clamp_cast_n", measure(n, [&] {
+                        clamp_cast::clamp_cast_n(values.data(), n, out.data());
+                        do_not_optimize(out.data());
+                      }));
+  }
+
+  if (selected("checked/sticky")) {
+    report_throughput("checked/sticky", measure(n, [&] {
+                        clamp_cast::saturation_flags flags;
+                        clamp_cast::clamp_cast_n(values.data(), n, out.data(),
+                                                 clamp_cast::sticky{flags});
+                        do_not_optimize(flags);
+                        do_not_optimize(out.data());
+                      }));
+  }
+
+  if (selected("checked/checked_clamp_cast_n")) {
+    report_throughput("checked/checked_clamp_cast_n", measure(n, [&] {
+                        const auto summary = clamp_cast::checked_clamp_cast_n(
+                            values.data(), n, out.data(), selection.data());
+                        do_not_optimize(summary);
+                        do_not_optimize(out.data());
+                      }));
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    filter = argv[1];
+  }
+  if (argc > 2) {
+    streaming_gib = std::atof(argv[2]);
+  }
+  benchmark_pairs<float>();
+  benchmark_pairs<double>();
+  benchmark_scenarios<int16_t, float>();
+  benchmark_scenarios<int32_t, float>();
+  benchmark_scenarios<int32_t, double>();
+  benchmark_scenarios<int64_t, double>();
+  clamp_cast::saturation_flags flags;
+  benchmark_adaptive<int16_t, float>(clamp_cast::sticky{flags}, "sticky/");
+  benchmark_adaptive<int32_t, double>(clamp_cast::sticky{flags}, "sticky/");
+  benchmark_adaptive<int64_t, double>();
+  benchmark_adaptive<uint64_t, float>();
+  benchmark_analyzed<float>();
+  benchmark_analyzed<double>();
+  benchmark_parallel<int16_t, float>();
+  benchmark_parallel<int64_t, double>();
+  benchmark_stream<int16_t, float>();
+  benchmark_stream<int32_t, double>();
+  benchmark_ring<int16_t, float>(64);
+  benchmark_ring<int16_t, float>(1024);
+  benchmark_streaming<int16_t, float>();
+  benchmark_streaming<int32_t, float>();
+  benchmark_streaming<int64_t, double>();
+#ifdef __linux__
+  benchmark_file<int16_t, float>();
+#endif
+  benchmark_cast_interval();
+  benchmark_checked();
+  write_json(std::cout);
+}
@@ -0,0 +1,200 @@
+#ifndef CLAMP_CAST_ANALYZED_HPP
+#define CLAMP_CAST_ANALYZED_HPP
+
+// Converts the same array to several integer types without checking every
+// element every time. analyzed_buffer summarizes every block of the array once
+// with its minimum, maximum and number of NaN, like the zone maps of a column
+// store. clamp_cast_n then converts the blocks that are inside of the bounds of
+// To without clamping and fills the blocks that clamp entirely with one value.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast {
+
+// The values of one block of an analyzed_buffer. minimum and maximum ignore
+// NaN. In a block of only NaN minimum is infinity and maximum is -infinity.
+template <typename From> struct block_summary {
+  From minimum;
+  From maximum;
+  std::uint32_t nans;
+};
+
+namespace detail {
+
+template <typename From>
+block_summary<From> summarize(const From *in, const std::size_t n) noexcept {
+  constexpr auto infinity = std::numeric_limits<From>::infinity();
+  From minimum{infinity};
+  From maximum{-infinity};
+  std::uint32_t nans{0};
+  std::size_t i{0};
+#ifdef CLAMP_CAST_SSE2
+  // minps and maxps return the second operand if either is NaN so NaN never
+  // replaces the running minimum and maximum.
+  if constexpr (std::is_same_v<From, float>) {
+    auto minimum_vector = _mm_set1_ps(infinity);
+    auto maximum_vector = _mm_set1_ps(-infinity);
+    auto nan_vector = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+      const auto x = _mm_loadu_ps(in + i);
+      minimum_vector = _mm_min_ps(x, minimum_vector);
+      maximum_vector = _mm_max_ps(x, maximum_vector);
+      // The comparison is -1 in the lanes that are NaN.
+      nan_vector = _mm_sub_epi32(nan_vector,
+                                 _mm_castps_si128(_mm_cmpunord_ps(x, x)));
+    }
+    alignas(16) float minimums[4];
+    alignas(16) float maximums[4];
+    alignas(16) std::uint32_t counts[4];
+    _mm_store_ps(minimums, minimum_vector);
+    _mm_store_ps(maximums, maximum_vector);
+    _mm_store_si128(reinterpret_cast<__m128i *>(counts), nan_vector);
+    for (int lane{0}; lane < 4; ++lane) {
+      minimum = std::min(minimum, minimums[lane]);
+      maximum = std::max(maximum, maximums[lane]);
+      nans += counts[lane];
+    }
+  } else if constexpr (std::is_same_v<From, double>) {
+    auto minimum_vector = _mm_set1_pd(infinity);
+    auto maximum_vector = _mm_set1_pd(-infinity);
+    auto nan_vector = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+      const auto x = _mm_loadu_pd(in + i);
+      minimum_vector = _mm_min_pd(x, minimum_vector);
+      maximum_vector = _mm_max_pd(x, maximum_vector);
+      nan_vector = _mm_sub_epi64(nan_vector,
+                                 _mm_castpd_si128(_mm_cmpunord_pd(x, x)));
+    }
+    alignas(16) double minimums[2];
+    alignas(16) double maximums[2];
+    alignas(16) std::uint64_t counts[2];
+    _mm_store_pd(minimums, minimum_vector);
+    _mm_store_pd(maximums, maximum_vector);
+    _mm_store_si128(reinterpret_cast<__m128i *>(counts), nan_vector);
+    for (int lane{0}; lane < 2; ++lane) {
+      minimum = std::min(minimum, minimums[lane]);
+      maximum = std::max(maximum, maximums[lane]);
+      nans += static_cast<std::uint32_t>(counts[lane]);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    if (is_nan(in[i])) {
+      ++nans;
+    } else {
+      minimum = std::min(minimum, in[i]);
+      maximum = std::max(maximum, in[i]);
+    }
+  }
+  return {minimum, maximum, nans};
+}
+
+// std::fill_n with vector stores, which compilers do not always generate for
+// types wider than a byte.
+template <typename To>
+void fill(To *out, const std::size_t n, const To value) noexcept {
+  std::size_t i{0};
+#ifdef CLAMP_CAST_SSE2
+  if constexpr (std::is_integral_v<To> && sizeof(To) <= 8) {
+    const auto vector = [value] {
+      if constexpr (sizeof(To) == 1) {
+        return _mm_set1_epi8(static_cast<char>(value));
+      } else if constexpr (sizeof(To) == 2) {
+        return _mm_set1_epi16(static_cast<short>(value));
+      } else if constexpr (sizeof(To) == 4) {
+        return _mm_set1_epi32(static_cast<int>(value));
+      } else {
+        return _mm_set1_epi64x(static_cast<long long>(value));
+      }
+    }();
+    constexpr auto step = vector_elements<To>;
+    for (; i + step <= n; i += step) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), vector);
+    }
+  }
+#endif
+  std::fill_n(out + i, n - i, value);
+}
+
+} // namespace detail
+
+// Block summaries of an array that is converted more than once. The array is
+// not copied and must outlive the analyzed_buffer. Analyze it again after
+// changing it.
+template <typename From> class analyzed_buffer {
+public:
+  static constexpr std::size_t block_size{1024};
+
+  analyzed_buffer(const From *data, const std::size_t size)
+      : data_{data}, size_{size} {
+    blocks_.reserve((size + block_size - 1) / block_size);
+    for (std::size_t i{0}; i < size; i += block_size) {
+      const std::size_t count{size - i < block_size ? size - i : block_size};
+      blocks_.push_back(detail::summarize(data + i, count));
+    }
+  }
+
+  const From *data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  // The summary of elements [i * block_size, (i + 1) * block_size).
+  const std::vector<block_summary<From>> &blocks() const noexcept {
+    return blocks_;
+  }
+
+private:
+  const From *data_;
+  std::size_t size_;
+  std::vector<block_summary<From>> blocks_;
+};
+
+// clamp_cast_n for an analyzed array. Each block is converted in one of three
+// ways depending on its summary and the bounds of To:
+// - all values NaN, all below or all above the bounds: clamp_cast of the first
+//   value is stored in every element. The policy is called once per block.
+// - all values inside of the bounds: without clamping, unless the SIMD kernel
+//   clamps as fast.
+// - otherwise: like clamp_cast_n.
+template <typename From, typename To, typename Policy = policy<>>
+void clamp_cast_n(const analyzed_buffer<From> &in, To *out,
+                  const Policy &policy = {} CLAMP_CAST_CALL_SITE) noexcept(
+    detail::is_nothrow_policy<To, Policy>) {
+  CLAMP_CAST_RECORD_N(To, in.data(), in.size());
+  CLAMP_CAST_PROFILE_N(To, in.data(), in.size());
+  const auto lower = lower_bound_inclusive<To, From>();
+  const auto upper = upper_bound_exclusive<To, From>();
+  constexpr auto block_size = analyzed_buffer<From>::block_size;
+  const From *data{in.data()};
+  // The SIMD kernels with a saturating policy are as fast as a conversion
+  // without clamping.
+  constexpr bool clamps_at_full_speed{has_simd_kernel<To, From>() &&
+                                      detail::is_saturating_policy<Policy>};
+  for (std::size_t b{0}; b < in.blocks().size(); ++b) {
+    const auto &block = in.blocks()[b];
+    const std::size_t begin{b * block_size};
+    const std::size_t count{in.size() - begin < block_size ? in.size() - begin
+                                                           : block_size};
+    const bool none_nan{block.nans == 0};
+    if (block.nans == count || (none_nan && block.maximum < lower) ||
+        (none_nan && block.minimum >= upper)) {
+      detail::fill(out + begin, count,
+                   clamp_cast<To>(data[begin], policy CLAMP_CAST_NO_CALL_SITE));
+    } else if (!clamps_at_full_speed && none_nan && block.minimum >= lower &&
+               block.maximum < upper) {
+      detail::convert_inside(data + begin, count, out + begin);
+    } else {
+      detail::clamp_cast_n_engine<engine::automatic>(data + begin, count,
+                                                     out + begin, policy);
+    }
+  }
+}
+
+} // namespace clamp_cast
+
+#endif
@@ -0,0 +1,1069 @@
+#ifndef CLAMP_CAST_BULK_HPP
+#define CLAMP_CAST_BULK_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "clamp-cast.hpp"
+
+// Defining CLAMP_CAST_PROFILE samples the inputs of clamp_cast_n, see
+// clamp-cast-profile.hpp.
+#ifdef CLAMP_CAST_PROFILE
+namespace clamp_cast::profile {
+template <typename To, typename From>
+void sample(const From *in, std::size_t n) noexcept;
+} // namespace clamp_cast::profile
+#define CLAMP_CAST_PROFILE_N(To, in, n) ::clamp_cast::profile::sample<To>(in, n)
+#else
+#define CLAMP_CAST_PROFILE_N(To, in, n)
+#endif
+
+// SIMD kernels are used when the target supports them. Define
+// CLAMP_CAST_NO_SIMD to always use the portable scalar kernels.
+#if defined(__SSE2__) && !defined(CLAMP_CAST_NO_SIMD)
+#define CLAMP_CAST_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace clamp_cast {
+
+namespace detail {
+
+// A short name of an arithmetic type for machine readable output.
+template <typename T> constexpr const char *type_name() noexcept {
+  if constexpr (std::is_same_v<T, float>) {
+    return "float";
+  } else if constexpr (std::is_same_v<T, double>) {
+    return "double";
+  } else if constexpr (std::is_same_v<T, long double>) {
+    return "long_double";
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return "bool";
+  } else if constexpr (std::is_integral_v<T>) {
+    constexpr const char *signed_names[]{"int8", "int16", "int32", "int64"};
+    constexpr const char *unsigned_names[]{"uint8", "uint16", "uint32",
+                                           "uint64"};
+    constexpr auto index = sizeof(T) == 1   ? 0
+                           : sizeof(T) == 2 ? 1
+                           : sizeof(T) == 4 ? 2
+                                            : 3;
+    return std::is_signed_v<T> ? signed_names[index] : unsigned_names[index];
+  } else {
+    return "unknown";
+  }
+}
+
+// The index of the lowest set bit. word must not be 0.
+inline unsigned lowest_bit(const std::uint64_t word) noexcept {
+#if defined(__GNUC__)
+  return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+  unsigned index{0};
+  while (((word >> index) & 1) == 0) {
+    ++index;
+  }
+  return index;
+#endif
+}
+
+inline unsigned count_bits(const std::uint64_t word) noexcept {
+#if defined(__GNUC__)
+  return static_cast<unsigned>(__builtin_popcountll(word));
+#else
+  unsigned count{0};
+  for (auto w = word; w != 0; w &= w - 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+// The smallest From value that is greater than or equal to i.
+template <typename From, typename Int> From ceil_to(const Int i) noexcept {
+  // The conversion rounds to one of the two neighboring values of i so at most
+  // one step is needed.
+  auto result = static_cast<From>(i);
+  if (cmp_less(result, i)) {
+    result = std::nextafter(result, std::numeric_limits<From>::infinity());
+  }
+  return result;
+}
+
+// The smallest From value that is greater than i.
+template <typename From, typename Int> From above(const Int i) noexcept {
+  auto result = ceil_to<From>(i);
+  if (cmp_equal(result, i)) {
+    result = std::nextafter(result, std::numeric_limits<From>::infinity());
+  }
+  return result;
+}
+
+// The smallest From value that is greater than or equal to i - 1/2 if ties
+// are included and greater than i - 1/2 otherwise.
+template <typename From, typename Int>
+From above_half(const Int i, const bool include_tie) noexcept {
+  // Below 2**(digits - 1) half integers are representable. Above it there are
+  // no From values strictly between i - 1 and i.
+  constexpr auto fractional_limit =
+      detail::exp2<From>(std::numeric_limits<From>::digits - 1);
+  if (cmp_greater(i, fractional_limit) ||
+      cmp_less_equal(i, -fractional_limit)) {
+    return ceil_to<From>(i);
+  }
+  const From tie{static_cast<From>(i - 1) + static_cast<From>(0.5)};
+  return include_tie
+             ? tie
+             : std::nextafter(tie, std::numeric_limits<From>::infinity());
+}
+
+// The smallest From value that rounds to an integer >= i.
+template <typename From, typename Int>
+From rounds_to_at_least(const Int i, const rounding mode) noexcept {
+  switch (mode) {
+  case rounding::toward_zero:
+    return i > 0 ? ceil_to<From>(i) : above<From>(i - 1);
+  case rounding::downward:
+    return ceil_to<From>(i);
+  case rounding::upward:
+    return above<From>(i - 1);
+  case rounding::to_nearest:
+    return above_half<From>(i, i % 2 == 0);
+  case rounding::to_nearest_away:
+    return above_half<From>(i, i > 0);
+  }
+  return From{0};
+}
+
+// The floating point comparisons that the exact mixed comparisons reduce to
+// once the integer threshold has been translated into From.
+enum class predicate { less, greater_equal, equal, not_equal };
+
+template <predicate P, typename From>
+constexpr bool evaluate(const From from, const From threshold) noexcept {
+  if constexpr (P == predicate::less) {
+    return from < threshold;
+  } else if constexpr (P == predicate::greater_equal) {
+    return from >= threshold;
+  } else if constexpr (P == predicate::equal) {
+    return from == threshold;
+  } else {
+    return from != threshold;
+  }
+}
+
+template <predicate P, typename From>
+std::uint64_t select_word_scalar(const From *in, const std::size_t n,
+                                 const From threshold) noexcept {
+  std::uint64_t word{0};
+  for (std::size_t i{0}; i < n; ++i) {
+    word |= std::uint64_t{evaluate<P>(in[i], threshold)} << i;
+  }
+  return word;
+}
+
+#ifdef CLAMP_CAST_SSE2
+template <predicate P> __m128 compare_ps(const __m128 a, const __m128 b) {
+  if constexpr (P == predicate::less) {
+    return _mm_cmplt_ps(a, b);
+  } else if constexpr (P == predicate::greater_equal) {
+    return _mm_cmpge_ps(a, b);
+  } else if constexpr (P == predicate::equal) {
+    return _mm_cmpeq_ps(a, b);
+  } else {
+    return _mm_cmpneq_ps(a, b);
+  }
+}
+
+template <predicate P> __m128d compare_pd(const __m128d a, const __m128d b) {
+  if constexpr (P == predicate::less) {
+    return _mm_cmplt_pd(a, b);
+  } else if constexpr (P == predicate::greater_equal) {
+    return _mm_cmpge_pd(a, b);
+  } else if constexpr (P == predicate::equal) {
+    return _mm_cmpeq_pd(a, b);
+  } else {
+    return _mm_cmpneq_pd(a, b);
+  }
+}
+
+template <predicate P>
+std::uint64_t select_word_simd(const float *in, const float threshold) {
+  const auto t = _mm_set1_ps(threshold);
+  std::uint64_t word{0};
+  for (unsigned i{0}; i < 64; i += 4) {
+    const auto mask = compare_ps<P>(_mm_loadu_ps(in + i), t);
+    word |= std::uint64_t{static_cast<unsigned>(_mm_movemask_ps(mask))} << i;
+  }
+  return word;
+}
+
+template <predicate P>
+std::uint64_t select_word_simd(const double *in, const double threshold) {
+  const auto t = _mm_set1_pd(threshold);
+  std::uint64_t word{0};
+  for (unsigned i{0}; i < 64; i += 2) {
+    const auto mask = compare_pd<P>(_mm_loadu_pd(in + i), t);
+    word |= std::uint64_t{static_cast<unsigned>(_mm_movemask_pd(mask))} << i;
+  }
+  return word;
+}
+#endif
+
+template <predicate P, typename From>
+void select(const From *in, const std::size_t n, const From threshold,
+            std::uint64_t *selection) noexcept {
+  const std::size_t full_words{n / 64};
+  for (std::size_t w{0}; w < full_words; ++w) {
+#ifdef CLAMP_CAST_SSE2
+    if constexpr (std::is_same_v<From, float> || std::is_same_v<From, double>) {
+      selection[w] = select_word_simd<P>(in + w * 64, threshold);
+      continue;
+    }
+#endif
+    selection[w] = select_word_scalar<P>(in + w * 64, 64, threshold);
+  }
+  if (n % 64 != 0) {
+    selection[full_words] =
+        select_word_scalar<P>(in + full_words * 64, n % 64, threshold);
+  }
+}
+
+template <typename From>
+std::uint64_t select_interval_word_scalar(const From *in, const std::size_t n,
+                                          const From lower,
+                                          const From upper) noexcept {
+  std::uint64_t word{0};
+  for (std::size_t i{0}; i < n; ++i) {
+    word |= std::uint64_t{lower <= in[i] && in[i] <= upper} << i;
+  }
+  return word;
+}
+
+#ifdef CLAMP_CAST_SSE2
+inline std::uint64_t select_interval_word_simd(const float *in,
+                                               const float lower,
+                                               const float upper) {
+  const auto l = _mm_set1_ps(lower);
+  const auto u = _mm_set1_ps(upper);
+  std::uint64_t word{0};
+  for (unsigned i{0}; i < 64; i += 4) {
+    const auto x = _mm_loadu_ps(in + i);
+    const auto mask = _mm_and_ps(_mm_cmple_ps(l, x), _mm_cmple_ps(x, u));
+    word |= std::uint64_t{static_cast<unsigned>(_mm_movemask_ps(mask))} << i;
+  }
+  return word;
+}
+
+inline std::uint64_t select_interval_word_simd(const double *in,
+                                               const double lower,
+                                               const double upper) {
+  const auto l = _mm_set1_pd(lower);
+  const auto u = _mm_set1_pd(upper);
+  std::uint64_t word{0};
+  for (unsigned i{0}; i < 64; i += 2) {
+    const auto x = _mm_loadu_pd(in + i);
+    const auto mask = _mm_and_pd(_mm_cmple_pd(l, x), _mm_cmple_pd(x, u));
+    word |= std::uint64_t{static_cast<unsigned>(_mm_movemask_pd(mask))} << i;
+  }
+  return word;
+}
+#endif
+
+template <typename From>
+void select_interval(const From *in, const std::size_t n, const From lower,
+                     const From upper, std::uint64_t *selection) noexcept {
+  const std::size_t full_words{n / 64};
+  for (std::size_t w{0}; w < full_words; ++w) {
+#ifdef CLAMP_CAST_SSE2
+    if constexpr (std::is_same_v<From, float> || std::is_same_v<From, double>) {
+      selection[w] = select_interval_word_simd(in + w * 64, lower, upper);
+      continue;
+    }
+#endif
+    selection[w] = select_interval_word_scalar(in + w * 64, 64, lower, upper);
+  }
+  if (n % 64 != 0) {
+    selection[full_words] = select_interval_word_scalar(
+        in + full_words * 64, n % 64, lower, upper);
+  }
+}
+
+// Sets every bit of the selection that corresponds to an element.
+inline void select_all(const std::size_t n, const bool value,
+                       std::uint64_t *selection) noexcept {
+  const std::uint64_t all{value ? ~std::uint64_t{0} : 0};
+  for (std::size_t w{0}; w < n / 64; ++w) {
+    selection[w] = all;
+  }
+  if (n % 64 != 0) {
+    selection[n / 64] = all & ((std::uint64_t{1} << (n % 64)) - 1);
+  }
+}
+
+} // namespace detail
+
+// Vectorized versions of the exact mixed comparisons for predicate evaluation.
+// Bit i % 64 of selection[i / 64] is set if the predicate holds for in[i].
+// selection must have room for (n + 63) / 64 words. Bits past n in the last
+// word are cleared.
+//
+// The integer threshold is translated once into a From threshold that gives the
+// same result for every From value so that the loop only compares floating
+// point values.
+template <typename From, typename Int>
+void filter_less(const From *in, const std::size_t n, const Int threshold,
+                 std::uint64_t *selection) noexcept {
+  // f < i <=> f < the smallest From that is >= i
+  detail::select<detail::predicate::less>(
+      in, n, detail::ceil_to<From>(threshold), selection);
+}
+
+template <typename From, typename Int>
+void filter_less_equal(const From *in, const std::size_t n, const Int threshold,
+                       std::uint64_t *selection) noexcept {
+  // f <= i <=> f < the smallest From that is > i
+  detail::select<detail::predicate::less>(
+      in, n, detail::above<From>(threshold), selection);
+}
+
+template <typename From, typename Int>
+void filter_greater(const From *in, const std::size_t n, const Int threshold,
+                    std::uint64_t *selection) noexcept {
+  // f > i <=> f >= the smallest From that is > i
+  detail::select<detail::predicate::greater_equal>(
+      in, n, detail::above<From>(threshold), selection);
+}
+
+template <typename From, typename Int>
+void filter_greater_equal(const From *in, const std::size_t n,
+                          const Int threshold,
+                          std::uint64_t *selection) noexcept {
+  // f >= i <=> f >= the smallest From that is >= i
+  detail::select<detail::predicate::greater_equal>(
+      in, n, detail::ceil_to<From>(threshold), selection);
+}
+
+template <typename From, typename Int>
+void filter_equal(const From *in, const std::size_t n, const Int threshold,
+                  std::uint64_t *selection) noexcept {
+  // If the threshold is not representable in From then no value is equal.
+  const auto converted = detail::ceil_to<From>(threshold);
+  if (cmp_equal(converted, threshold)) {
+    detail::select<detail::predicate::equal>(in, n, converted, selection);
+  } else {
+    detail::select_all(n, false, selection);
+  }
+}
+
+template <typename From, typename Int>
+void filter_not_equal(const From *in, const std::size_t n, const Int threshold,
+                      std::uint64_t *selection) noexcept {
+  const auto converted = detail::ceil_to<From>(threshold);
+  if (cmp_equal(converted, threshold)) {
+    detail::select<detail::predicate::not_equal>(in, n, converted, selection);
+  } else {
+    detail::select_all(n, true, selection);
+  }
+}
+
+// A closed interval [lower, upper] of floating point values. An interval with
+// lower > upper is empty.
+template <typename From> struct interval {
+  From lower;
+  From upper;
+
+  constexpr bool contains(const From from) const noexcept {
+    return lower <= from && from <= upper;
+  }
+};
+
+// Translates the predicate `low <= clamp_cast<To>(rounded from) <= high` on
+// integers into an interval on From. For every From value that is not NaN the
+// predicate holds if and only if the value is in the returned interval. NaN is
+// in no interval.
+//
+// This lets a scan evaluate a predicate on a cast column with two floating
+// point comparisons per element and no conversions. Like the bounds of
+// clamp_cast the interval is exact: it does not convert the integer bounds to
+// From and round them. The interval is closed rather than half open like
+// [lower_bound_inclusive, upper_bound_exclusive) because when high is the
+// maximum of To it has to include infinity.
+template <typename To, typename From>
+interval<From> cast_interval(const To low, const To high,
+                             const rounding mode = rounding::toward_zero) {
+  using to_limits = std::numeric_limits<To>;
+  using from_limits = std::numeric_limits<From>;
+  static_assert(to_limits::is_integer);
+
+  if (low > high) {
+    return {From{1}, From{0}};
+  }
+  // Values that clamp to the bounds of To are included if the interval
+  // includes the bounds.
+  return {low == to_limits::min()
+              ? -from_limits::infinity()
+              : detail::rounds_to_at_least<From>(low, mode),
+          high == to_limits::max()
+              ? from_limits::infinity()
+              : std::nextafter(detail::rounds_to_at_least<From>(
+                                   static_cast<To>(high + 1), mode),
+                               -from_limits::infinity())};
+}
+
+// Sets bit i % 64 of selection[i / 64] if in[i] is in the interval. See
+// filter_less.
+template <typename From>
+void filter_in(const From *in, const std::size_t n,
+               const interval<From> range,
+               std::uint64_t *selection) noexcept {
+  detail::select_interval(in, n, range.lower, range.upper, selection);
+}
+
+// Implementations of the bulk conversions.
+enum class engine {
+  // The fastest engine that supports the types.
+  automatic,
+  // clamp_cast for every element.
+  scalar,
+  // SIMD instructions for as many elements as possible and scalar for the
+  // rest. Types without a SIMD kernel use scalar, see has_simd_kernel.
+  simd,
+  // Checks every block of about 8 KiB of values with vector comparisons and
+  // converts blocks that are inside of the bounds of To without clamping.
+  // Other blocks use automatic. This is fastest when nearly all values are in
+  // range, especially for pairs without a SIMD kernel.
+  prescan,
+  // Like automatic but outputs of at least streaming_threshold bytes are
+  // written with non-temporal stores that bypass the caches. This is faster
+  // for outputs much larger than the last level cache that are not read again
+  // soon, and slower for outputs that are.
+  streaming,
+};
+
+// The output size in bytes from which engine::streaming uses non-temporal
+// stores. The default is larger than the last level cache of most desktop
+// processors.
+#ifndef CLAMP_CAST_STREAMING_THRESHOLD
+#define CLAMP_CAST_STREAMING_THRESHOLD (std::size_t{1} << 25)
+#endif
+constexpr std::size_t streaming_threshold{CLAMP_CAST_STREAMING_THRESHOLD};
+
+// Whether engine::simd has a kernel for converting From to To on this target.
+template <typename To, typename From>
+constexpr bool has_simd_kernel() noexcept {
+#ifdef CLAMP_CAST_SSE2
+  // The kernels convert to int32 lanes and narrow from there.
+  using to_limits = std::numeric_limits<To>;
+  return (std::is_same_v<From, float> || std::is_same_v<From, double>) &&
+         to_limits::is_integer && !std::is_same_v<To, bool> &&
+         sizeof(To) <= 4 && to_limits::digits <= 31;
+#else
+  return false;
+#endif
+}
+
+namespace detail {
+
+template <typename To, typename From, typename Policy>
+void clamp_cast_n_scalar(const From *in, const std::size_t n, To *out,
+                         const Policy &policy) noexcept(
+    is_nothrow_policy<To, Policy>) {
+  for (std::size_t i{0}; i < n; ++i) {
+    out[i] = clamp_cast<To>(in[i], policy CLAMP_CAST_NO_CALL_SITE);
+  }
+}
+
+#ifdef CLAMP_CAST_SSE2
+// Converts 4 values to int32 lanes that are clamped to the range of To.
+template <typename To> __m128i to_int32_lanes(const float *in) {
+  const auto x = _mm_loadu_ps(in);
+  // NaN becomes 0.
+  const auto ordered = _mm_and_ps(x, _mm_cmpord_ps(x, x));
+  const auto lower = _mm_set1_ps(lower_bound_inclusive<To, float>());
+  if constexpr (std::numeric_limits<To>::digits < 31) {
+    // The maximum of To is representable so we can clamp before converting.
+    const auto upper =
+        _mm_set1_ps(static_cast<float>(std::numeric_limits<To>::max()));
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(ordered, lower), upper));
+  } else {
+    // The conversion returns INT32_MIN for values outside of the range which
+    // is correct for values below it. For values above we flip all bits to
+    // get INT32_MAX.
+    const auto above = _mm_cmpge_ps(
+        ordered, _mm_set1_ps(upper_bound_exclusive<To, float>()));
+    return _mm_xor_si128(_mm_cvttps_epi32(ordered), _mm_castps_si128(above));
+  }
+}
+
+// Converts 4 values to int32 lanes that are clamped to the range of To.
+template <typename To> __m128i to_int32_lanes(const double *in) {
+  // double can represent all int32 values so we can always clamp before
+  // converting.
+  const auto lower = _mm_set1_pd(lower_bound_inclusive<To, double>());
+  const auto upper =
+      _mm_set1_pd(static_cast<double>(std::numeric_limits<To>::max()));
+  const auto convert = [&](const double *half) {
+    const auto x = _mm_loadu_pd(half);
+    const auto ordered = _mm_and_pd(x, _mm_cmpord_pd(x, x));
+    return _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(ordered, lower), upper));
+  };
+  return _mm_unpacklo_epi64(convert(in), convert(in + 2));
+}
+
+// Converts 4 values that are inside of the bounds of To to int32 lanes without
+// clamping.
+inline __m128i truncate_to_int32_lanes(const float *in) {
+  return _mm_cvttps_epi32(_mm_loadu_ps(in));
+}
+
+inline __m128i truncate_to_int32_lanes(const double *in) {
+  return _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_loadu_pd(in)),
+                            _mm_cvttpd_epi32(_mm_loadu_pd(in + 2)));
+}
+
+// The number of elements that convert_vector converts.
+template <typename To> constexpr std::size_t vector_elements{16 / sizeof(To)};
+
+// Converts vector_elements<To> values into one vector of To. If Inside then
+// the values must be inside of the bounds of To and are not clamped.
+template <typename To, bool Inside = false, typename From>
+__m128i convert_vector(const From *in) {
+  const auto to_int32_lanes = [](const From *lanes) {
+    if constexpr (Inside) {
+      return truncate_to_int32_lanes(lanes);
+    } else {
+      return detail::to_int32_lanes<To>(lanes);
+    }
+  };
+  if constexpr (sizeof(To) == 4) {
+    return to_int32_lanes(in);
+  } else if constexpr (sizeof(To) == 2) {
+    const auto a = to_int32_lanes(in);
+    const auto b = to_int32_lanes(in + 4);
+    if constexpr (std::numeric_limits<To>::is_signed) {
+      return _mm_packs_epi32(a, b);
+    } else {
+      // SSE2 only has a signed saturating pack so we shift the range to
+      // int16 and back.
+      const auto offset = _mm_set1_epi32(32768);
+      return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, offset),
+                                           _mm_sub_epi32(b, offset)),
+                           _mm_set1_epi16(-32768));
+    }
+  } else {
+    const auto ab = _mm_packs_epi32(to_int32_lanes(in), to_int32_lanes(in + 4));
+    const auto cd =
+        _mm_packs_epi32(to_int32_lanes(in + 8), to_int32_lanes(in + 12));
+    if constexpr (std::numeric_limits<To>::is_signed) {
+      return _mm_packs_epi16(ab, cd);
+    } else {
+      return _mm_packus_epi16(ab, cd);
+    }
+  }
+}
+
+// A bit mask of the vector_elements<To> values that clamp_cast cannot convert.
+template <typename To> unsigned outside_mask(const float *in) {
+  const auto lower = _mm_set1_ps(lower_bound_inclusive<To, float>());
+  const auto upper = _mm_set1_ps(upper_bound_exclusive<To, float>());
+  unsigned mask{0};
+  for (unsigned i{0}; i < vector_elements<To>; i += 4) {
+    const auto x = _mm_loadu_ps(in + i);
+    // NaN is not inside of the bounds either.
+    const auto inside =
+        _mm_and_ps(_mm_cmpge_ps(x, lower), _mm_cmplt_ps(x, upper));
+    mask |= (static_cast<unsigned>(_mm_movemask_ps(inside)) ^ 0xfu) << i;
+  }
+  return mask;
+}
+
+template <typename To> unsigned outside_mask(const double *in) {
+  const auto lower = _mm_set1_pd(lower_bound_inclusive<To, double>());
+  const auto upper = _mm_set1_pd(upper_bound_exclusive<To, double>());
+  unsigned mask{0};
+  for (unsigned i{0}; i < vector_elements<To>; i += 2) {
+    const auto x = _mm_loadu_pd(in + i);
+    const auto inside =
+        _mm_and_pd(_mm_cmpge_pd(x, lower), _mm_cmplt_pd(x, upper));
+    mask |= (static_cast<unsigned>(_mm_movemask_pd(inside)) ^ 0x3u) << i;
+  }
+  return mask;
+}
+
+// Collects the saturation_flags events of the vectors it is given in vector
+// registers so that the events cost a few bitwise ors per vector and no
+// branches.
+class event_accumulator {
+public:
+  template <typename To> void add(const float *in) {
+    const auto lower = _mm_set1_ps(lower_bound_inclusive<To, float>());
+    const auto upper = _mm_set1_ps(upper_bound_exclusive<To, float>());
+    for (unsigned i{0}; i < vector_elements<To>; i += 4) {
+      const auto x = _mm_loadu_ps(in + i);
+      add(_mm_castps_si128(_mm_cmpunord_ps(x, x)),
+          _mm_castps_si128(_mm_cmplt_ps(x, lower)),
+          _mm_castps_si128(_mm_cmpge_ps(x, upper)));
+    }
+  }
+
+  template <typename To> void add(const double *in) {
+    const auto lower = _mm_set1_pd(lower_bound_inclusive<To, double>());
+    const auto upper = _mm_set1_pd(upper_bound_exclusive<To, double>());
+    for (unsigned i{0}; i < vector_elements<To>; i += 2) {
+      const auto x = _mm_loadu_pd(in + i);
+      add(_mm_castpd_si128(_mm_cmpunord_pd(x, x)),
+          _mm_castpd_si128(_mm_cmplt_pd(x, lower)),
+          _mm_castpd_si128(_mm_cmpge_pd(x, upper)));
+    }
+  }
+
+  // Reduces the vectors to saturation_flags events.
+  unsigned events() const {
+    return (_mm_movemask_epi8(nan_) != 0 ? saturation_flags::nan : 0u) |
+           (_mm_movemask_epi8(low_) != 0 ? saturation_flags::underflow : 0u) |
+           (_mm_movemask_epi8(high_) != 0 ? saturation_flags::overflow : 0u);
+  }
+
+private:
+  void add(const __m128i nan, const __m128i low, const __m128i high) {
+    nan_ = _mm_or_si128(nan_, nan);
+    low_ = _mm_or_si128(low_, low);
+    high_ = _mm_or_si128(high_, high);
+  }
+
+  __m128i nan_{_mm_setzero_si128()};
+  __m128i low_{_mm_setzero_si128()};
+  __m128i high_{_mm_setzero_si128()};
+};
+
+template <typename To, typename From, typename Policy>
+void clamp_cast_n_simd(const From *in, const std::size_t n, To *out,
+                       const Policy &policy) noexcept(
+    is_nothrow_policy<To, Policy>) {
+  constexpr auto step = vector_elements<To>;
+  std::size_t i{0};
+  if constexpr (std::is_same_v<Policy, sticky>) {
+    event_accumulator events;
+    for (; i + step <= n; i += step) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                       convert_vector<To>(in + i));
+      events.add<To>(in + i);
+    }
+    policy.flags().raise(events.events());
+  } else {
+    for (; i + step <= n; i += step) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                       convert_vector<To>(in + i));
+      if constexpr (!is_saturating_policy<Policy>) {
+        // The vector saturated like policy<>. Let the policy handle the
+        // elements that were outside of the bounds.
+        for (auto mask = outside_mask<To>(in + i); mask != 0;
+             mask &= mask - 1) {
+          const auto lane = lowest_bit(mask);
+          out[i + lane] = clamp_cast<To>(in[i + lane],
+                                        policy CLAMP_CAST_NO_CALL_SITE);
+        }
+      }
+    }
+  }
+  clamp_cast_n_scalar(in + i, n - i, out + i, policy);
+}
+
+// Orders the non-temporal stores before the stores that follow, also when the
+// policy throws.
+struct store_fence {
+  store_fence() = default;
+  store_fence(const store_fence &) = delete;
+  store_fence &operator=(const store_fence &) = delete;
+  ~store_fence() { _mm_sfence(); }
+};
+
+// Like clamp_cast_n_simd but writes whole vectors with non-temporal stores.
+// They need 16 byte aligned addresses so the elements up to the first aligned
+// one are converted with clamp_cast_n_scalar. Pairs without a SIMD kernel are
+// converted with clamp_cast into a vector first.
+template <typename To, typename From, typename Policy>
+void clamp_cast_n_nontemporal(const From *in, const std::size_t n, To *out,
+                              const Policy &policy) noexcept(
+    is_nothrow_policy<To, Policy>) {
+  constexpr auto step = vector_elements<To>;
+  const auto misalignment = reinterpret_cast<std::uintptr_t>(out) % 16;
+  if (misalignment % sizeof(To) != 0) {
+    clamp_cast_n_scalar(in, n, out, policy);
+    return;
+  }
+  const std::size_t to_aligned{(16 - misalignment) % 16 / sizeof(To)};
+  const std::size_t head{n < to_aligned ? n : to_aligned};
+  clamp_cast_n_scalar(in, head, out, policy);
+  std::size_t i{head};
+  {
+    const store_fence fence;
+    event_accumulator events;
+    for (; i + step <= n; i += step) {
+      __m128i vector;
+      if constexpr (has_simd_kernel<To, From>()) {
+        vector = convert_vector<To>(in + i);
+        if constexpr (std::is_same_v<Policy, sticky>) {
+          events.add<To>(in + i);
+        } else if constexpr (!is_saturating_policy<Policy>) {
+          if (const auto mask = outside_mask<To>(in + i); mask != 0) {
+            alignas(16) To lanes[step];
+            _mm_store_si128(reinterpret_cast<__m128i *>(lanes), vector);
+            clamp_cast_n_scalar(in + i, step, lanes, policy);
+            vector = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes));
+          }
+        }
+      } else if constexpr (sizeof(To) == 8) {
+        // Storing the lanes and loading them as a vector would stall on the
+        // store forwarding.
+        const auto low = clamp_cast<To>(in[i], policy CLAMP_CAST_NO_CALL_SITE);
+        const auto high =
+            clamp_cast<To>(in[i + 1], policy CLAMP_CAST_NO_CALL_SITE);
+        vector = _mm_set_epi64x(static_cast<long long>(high),
+                                static_cast<long long>(low));
+      } else {
+        alignas(16) To lanes[step];
+        clamp_cast_n_scalar(in + i, step, lanes, policy);
+        vector = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes));
+      }
+      _mm_stream_si128(reinterpret_cast<__m128i *>(out + i), vector);
+    }
+    if constexpr (has_simd_kernel<To, From>() &&
+                  std::is_same_v<Policy, sticky>) {
+      policy.flags().raise(events.events());
+    }
+  }
+  clamp_cast_n_scalar(in + i, n - i, out + i, policy);
+}
+#endif
+
+// engine::streaming regardless of the size of the output.
+template <typename To, typename From, typename Policy>
+void clamp_cast_n_streaming(const From *in, const std::size_t n, To *out,
+                            const Policy &policy) noexcept(
+    is_nothrow_policy<To, Policy>) {
+#ifdef CLAMP_CAST_SSE2
+  clamp_cast_n_nontemporal(in, n, out, policy);
+#else
+  clamp_cast_n_scalar(in, n, out, policy);
+#endif
+}
+
+// Whether all n values are inside of the bounds of To so that static_cast can
+// convert them. NaN is not. The comparisons of all values are combined without
+// branches.
+template <typename To, typename From>
+bool all_inside(const From *in, const std::size_t n) noexcept {
+  const auto lower = lower_bound_inclusive<To, From>();
+  const auto upper = upper_bound_exclusive<To, From>();
+  unsigned inside{1};
+  std::size_t i{0};
+#ifdef CLAMP_CAST_SSE2
+  if constexpr (std::is_same_v<From, float>) {
+    const auto lower_vector = _mm_set1_ps(lower);
+    const auto upper_vector = _mm_set1_ps(upper);
+    auto all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (; i + 4 <= n; i += 4) {
+      const auto x = _mm_loadu_ps(in + i);
+      all = _mm_and_ps(all, _mm_and_ps(_mm_cmpge_ps(x, lower_vector),
+                                       _mm_cmplt_ps(x, upper_vector)));
+    }
+    inside = _mm_movemask_ps(all) == 0xf;
+  } else if constexpr (std::is_same_v<From, double>) {
+    const auto lower_vector = _mm_set1_pd(lower);
+    const auto upper_vector = _mm_set1_pd(upper);
+    auto all = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    for (; i + 2 <= n; i += 2) {
+      const auto x = _mm_loadu_pd(in + i);
+      all = _mm_and_pd(all, _mm_and_pd(_mm_cmpge_pd(x, lower_vector),
+                                       _mm_cmplt_pd(x, upper_vector)));
+    }
+    inside = _mm_movemask_pd(all) == 0x3;
+  }
+#endif
+  for (; i < n; ++i) {
+    inside &= unsigned{in[i] >= lower} & unsigned{in[i] < upper};
+  }
+  return inside != 0;
+}
+
+// Converts n values that are all inside of the bounds of To without clamping.
+template <typename From, typename To>
+void convert_inside(const From *in, const std::size_t n, To *out) noexcept {
+  std::size_t i{0};
+#ifdef CLAMP_CAST_SSE2
+  if constexpr (has_simd_kernel<To, From>()) {
+    constexpr auto step = vector_elements<To>;
+    for (; i + step <= n; i += step) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                       convert_vector<To, true>(in + i));
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = static_cast<To>(in[i]);
+  }
+}
+
+#ifdef CLAMP_CAST_SSE2
+// Converts n values without clamping and returns whether they were all inside
+// of the bounds of To. If not then some elements of out are wrong. This checks
+// and converts in one pass instead of two.
+template <typename From, typename To>
+bool convert_if_inside(const From *in, const std::size_t n, To *out) noexcept {
+  constexpr auto step = vector_elements<To>;
+  std::size_t i{0};
+  unsigned outside{0};
+  for (; i + step <= n; i += step) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     convert_vector<To, true>(in + i));
+    outside |= outside_mask<To>(in + i);
+  }
+  if (outside != 0 || !all_inside<To>(in + i, n - i)) {
+    return false;
+  }
+  convert_inside(in + i, n - i, out + i);
+  return true;
+}
+#endif
+
+// The number of values that engine::prescan checks at once. The block stays in
+// the L1 cache between checking and converting it.
+template <typename From>
+constexpr std::size_t prescan_block{8192 / sizeof(From)};
+
+template <engine Engine, typename From, typename To, typename Policy>
+void clamp_cast_n_engine(const From *in, const std::size_t n, To *out,
+                         const Policy &policy) noexcept(
+    is_nothrow_policy<To, Policy>) {
+  if constexpr (Engine == engine::streaming) {
+    if (n * sizeof(To) >= streaming_threshold) {
+      clamp_cast_n_streaming(in, n, out, policy);
+    } else {
+      clamp_cast_n_engine<engine::automatic>(in, n, out, policy);
+    }
+    return;
+  }
+  if constexpr (Engine == engine::prescan) {
+    for (std::size_t i{0}; i < n; i += prescan_block<From>) {
+      const std::size_t count{
+          n - i < prescan_block<From> ? n - i : prescan_block<From>};
+#ifdef CLAMP_CAST_SSE2
+      if constexpr (has_simd_kernel<To, From>()) {
+        if (convert_if_inside(in + i, count, out + i)) {
+          continue;
+        }
+        clamp_cast_n_engine<engine::automatic>(in + i, count, out + i, policy);
+        continue;
+      }
+#endif
+      if (all_inside<To>(in + i, count)) {
+        convert_inside(in + i, count, out + i);
+      } else {
+        clamp_cast_n_engine<engine::automatic>(in + i, count, out + i, policy);
+      }
+    }
+    return;
+  }
+#ifdef CLAMP_CAST_SSE2
+  if constexpr (Engine != engine::scalar && has_simd_kernel<To, From>()) {
+    clamp_cast_n_simd(in, n, out, policy);
+    return;
+  }
+#endif
+  clamp_cast_n_scalar(in, n, out, policy);
+}
+
+} // namespace detail
+
+// Converts n values from in with clamp_cast and stores them in out. The ranges
+// must not overlap.
+//
+// The policy applies to every element like with the scalar clamp_cast. If the
+// policy throws then the elements before the failing one have been converted.
+template <engine Engine = engine::automatic, typename From, typename To,
+          typename Policy = policy<>>
+void clamp_cast_n(const From *in, const std::size_t n, To *out,
+                  const Policy &policy = {} CLAMP_CAST_CALL_SITE) noexcept(
+    detail::is_nothrow_policy<To, Policy>) {
+  CLAMP_CAST_RECORD_N(To, in, n);
+  CLAMP_CAST_PROFILE_N(To, in, n);
+  detail::clamp_cast_n_engine<Engine>(in, n, out, policy);
+}
+
+// The elements that checked_clamp_cast_n clamped or converted from NaN.
+struct saturation_summary {
+  // The number of such elements.
+  std::size_t count;
+  // The index of the first such element or n if there is none.
+  std::size_t first;
+  // How many of them were NaN, below the range of To (saturated_low) and above
+  // it (saturated_high).
+  std::size_t nans{0};
+  std::size_t underflows{0};
+  std::size_t overflows{0};
+};
+
+namespace detail {
+
+// Converts up to 64 elements and returns a bit mask of the elements with a
+// status other than exact or truncated.
+template <engine Engine, typename From, typename To>
+std::uint64_t checked_clamp_cast_word(const From *in, const std::size_t n,
+                                      To *out) noexcept {
+  if constexpr (Engine == engine::prescan) {
+    if (all_inside<To>(in, n)) {
+      convert_inside(in, n, out);
+      return 0;
+    }
+  }
+  std::uint64_t word{0};
+  std::size_t i{0};
+#ifdef CLAMP_CAST_SSE2
+  if constexpr (Engine != engine::scalar && has_simd_kernel<To, From>()) {
+    constexpr auto step = vector_elements<To>;
+    for (; i + step <= n; i += step) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                       convert_vector<To>(in + i));
+      word |= std::uint64_t{outside_mask<To>(in + i)} << i;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    const auto result = checked_clamp_cast<To>(in[i]);
+    out[i] = result.value;
+    word |= std::uint64_t{result.status != conversion_status::exact &&
+                          result.status != conversion_status::truncated}
+            << i;
+  }
+  return word;
+}
+
+} // namespace detail
+
+// clamp_cast_n that also reports which elements were clamped or NaN. Bit
+// i % 64 of selection[i / 64] is set for such elements like in the filters.
+// selection can be null if only the summary is needed. The summary counts the
+// elements of each status. The selection has one bit per element, so the
+// status of a selected element is that of checked_clamp_cast: nan if it is
+// NaN, otherwise saturated_low if it is negative and saturated_high if not.
+//
+// Ingest can use the summary to reject a batch without scanning it again.
+template <engine Engine = engine::automatic, typename From, typename To>
+saturation_summary checked_clamp_cast_n(const From *in, const std::size_t n,
+                                        To *out,
+                                        std::uint64_t *selection) noexcept {
+  saturation_summary summary{0, n};
+  for (std::size_t w{0}; w * 64 < n; ++w) {
+    const std::size_t begin{w * 64};
+    const std::size_t count{n - begin < 64 ? n - begin : 64};
+    const auto word =
+        detail::checked_clamp_cast_word<Engine>(in + begin, count, out + begin);
+    if (selection != nullptr) {
+      selection[w] = word;
+    }
+    if (word != 0) {
+      if (summary.count == 0) {
+        summary.first = begin + detail::lowest_bit(word);
+      }
+      summary.count += detail::count_bits(word);
+      // Only the selected elements are classified, without branches because
+      // they are often mixed randomly.
+      for (auto bits = word; bits != 0; bits &= bits - 1) {
+        const From value{in[begin + detail::lowest_bit(bits)]};
+        summary.nans += is_nan(value);
+        summary.underflows += value < From{0};
+        summary.overflows += value > From{0};
+      }
+    }
+  }
+  return summary;
+}
+
+// Converts a stream of arrays like clamp_cast_n and adapts to how often the
+// values are outside of the bounds of To, for example quiet audio with bursts
+// of clipping. Every block of block_size elements is converted in one of two
+// modes:
+// - optimistic: check with vector comparisons that the whole block is inside
+//   of the bounds and convert it without clamping, or with clamp_cast_n if the
+//   check fails.
+// - saturating: convert the block with clamp_cast_n without the check.
+//
+// The converter keeps a moving average of the share of checked blocks that
+// fail the check. It switches to saturating above 1/2 and back to optimistic
+// below 1/8 so that it does not switch back and forth on every block. In
+// saturating mode every 4th block is still checked to notice when the values
+// are back in range.
+//
+// The adaptation only runs for pairs without a SIMD kernel, such as double to
+// int64, or with a policy that does not saturate, such as sticky. The SIMD
+// kernels with a saturating policy cost the same for all values and are faster
+// than the check so for them the converter always uses clamp_cast_n.
+template <typename To, typename From, typename Policy = policy<>>
+class adaptive_converter {
+public:
+  static constexpr std::size_t block_size{1024};
+
+  adaptive_converter() = default;
+  explicit adaptive_converter(const Policy &policy) : policy_{policy} {}
+
+  void operator()(const From *in, const std::size_t n,
+                  To *out CLAMP_CAST_CALL_SITE) noexcept(
+      detail::is_nothrow_policy<To, Policy>) {
+    CLAMP_CAST_RECORD_N(To, in, n);
+    CLAMP_CAST_PROFILE_N(To, in, n);
+    for (std::size_t i{0}; i < n; i += block_size) {
+      const std::size_t count{n - i < block_size ? n - i : block_size};
+      convert_block(in + i, count, out + i);
+    }
+  }
+
+  // Whether the next block is converted optimistically.
+  bool optimistic() const noexcept { return optimistic_; }
+
+private:
+  // The average is in units of 1/scale and moves a quarter of the way to every
+  // new sample.
+  static constexpr unsigned scale{256};
+
+  void convert_block(const From *in, const std::size_t n, To *out) noexcept(
+      detail::is_nothrow_policy<To, Policy>) {
+    if constexpr (has_simd_kernel<To, From>() &&
+                  detail::is_saturating_policy<Policy>) {
+      detail::clamp_cast_n_engine<engine::automatic>(in, n, out, policy_);
+      return;
+    }
+    if (!optimistic_ && ++skipped_ % 4 != 0) {
+      detail::clamp_cast_n_engine<engine::automatic>(in, n, out, policy_);
+      return;
+    }
+    const bool inside{detail::all_inside<To>(in, n)};
+    failed_ = failed_ - failed_ / 4 + (inside ? 0 : scale / 4);
+    if (optimistic_ && failed_ > scale / 2) {
+      optimistic_ = false;
+    } else if (!optimistic_ && failed_ < scale / 8) {
+      optimistic_ = true;
+    }
+    if (inside) {
+      detail::convert_inside(in, n, out);
+    } else {
+      detail::clamp_cast_n_engine<engine::automatic>(in, n, out, policy_);
+    }
+  }
+
+  Policy policy_{};
+  unsigned failed_{0};
+  unsigned skipped_{0};
+  bool optimistic_{true};
+};
+
+} // namespace clamp_cast
+
+#ifdef CLAMP_CAST_PROFILE
+#include "clamp-cast-profile.hpp"
+#endif
+
+#endif
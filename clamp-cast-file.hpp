@@ -0,0 +1,350 @@
+#ifndef CLAMP_CAST_FILE_HPP
+#define CLAMP_CAST_FILE_HPP
+
+// Converts files of raw binary values, for example a .f32 dump to .i16, on
+// Linux. file::convert maps the input and the output and converts them in
+// chunks on a parallel::thread_pool with checked_clamp_cast_n, which also
+// counts the values that were clamped. The values can be scaled, rounded and
+// byte swapped on the way. convert.cpp is a command line tool around it.
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast-parallel.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast::file {
+
+enum class byte_order {
+  little,
+  big,
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  native = big,
+#else
+  native = little,
+#endif
+};
+
+struct options {
+  // Every value x is converted as rounded(x * scale + offset), computed in the
+  // input type.
+  double scale{1.0};
+  double offset{0.0};
+  rounding round{rounding::toward_zero};
+  byte_order input_order{byte_order::native};
+  byte_order output_order{byte_order::native};
+  // The number of threads or 0 for every hardware thread.
+  unsigned threads{0};
+};
+
+struct result {
+  std::size_t values{0};
+  // The bytes of the values that were read and written.
+  std::size_t bytes{0};
+  // The values that were NaN, below or above the range of To after scaling
+  // and rounding.
+  std::size_t nans{0};
+  std::size_t underflows{0};
+  std::size_t overflows{0};
+  // The time from opening the input to closing the output.
+  double seconds{0.0};
+};
+
+namespace detail {
+
+[[noreturn]] inline void throw_errno(const std::string &what) {
+  throw std::system_error{errno, std::generic_category(), what};
+}
+
+class descriptor {
+public:
+  descriptor(const char *path, const int flags, const mode_t mode = 0)
+      : fd_{::open(path, flags | O_CLOEXEC, mode)} {
+    if (fd_ < 0) {
+      throw_errno(std::string{"cannot open "} + path);
+    }
+  }
+  descriptor(const descriptor &) = delete;
+  descriptor &operator=(const descriptor &) = delete;
+  ~descriptor() { ::close(fd_); }
+
+  int get() const noexcept { return fd_; }
+
+  std::size_t size() const {
+    struct stat status;
+    if (::fstat(fd_, &status) != 0) {
+      throw_errno("fstat");
+    }
+    return static_cast<std::size_t>(status.st_size);
+  }
+
+private:
+  int fd_;
+};
+
+// Truncates the output, which is opened without O_TRUNC so that it can first
+// be compared with the input. Converting a file into itself would destroy the
+// input before it is read, so that throws std::invalid_argument.
+inline void truncate_output(const descriptor &in_file,
+                            const descriptor &out_file, const char *output) {
+  struct stat in_status;
+  struct stat out_status;
+  if (::fstat(in_file.get(), &in_status) != 0 ||
+      ::fstat(out_file.get(), &out_status) != 0) {
+    throw_errno("fstat");
+  }
+  if (in_status.st_dev == out_status.st_dev &&
+      in_status.st_ino == out_status.st_ino) {
+    throw std::invalid_argument{std::string{output} + " is the input"};
+  }
+  if (::ftruncate(out_file.get(), 0) != 0) {
+    throw_errno("ftruncate");
+  }
+}
+
+// A shared mapping of a whole file. The hints are only hints so their errors
+// are ignored: huge pages of files need a file system that supports them such
+// as tmpfs.
+class mapping {
+public:
+  mapping(const descriptor &file, const std::size_t size, const int protection)
+      : size_{size} {
+    if (size == 0) {
+      return;
+    }
+    memory_ = ::mmap(nullptr, size, protection, MAP_SHARED, file.get(), 0);
+    if (memory_ == MAP_FAILED) {
+      memory_ = nullptr;
+      throw_errno("mmap");
+    }
+    ::madvise(memory_, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    ::madvise(memory_, size, MADV_HUGEPAGE);
+#endif
+  }
+  mapping(const mapping &) = delete;
+  mapping &operator=(const mapping &) = delete;
+  ~mapping() {
+    if (memory_ != nullptr) {
+      ::munmap(memory_, size_);
+    }
+  }
+
+  void *get() const noexcept { return memory_; }
+
+private:
+  void *memory_{nullptr};
+  std::size_t size_;
+};
+
+template <typename T> T byte_swap(const T value) noexcept {
+  using bits_type = std::conditional_t<
+      sizeof(T) == 1, std::uint8_t,
+      std::conditional_t<sizeof(T) == 2, std::uint16_t,
+                         std::conditional_t<sizeof(T) == 4, std::uint32_t,
+                                            std::uint64_t>>>;
+  static_assert(sizeof(T) == sizeof(bits_type));
+  bits_type bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  bits_type swapped{0};
+  for (std::size_t i{0}; i < sizeof(T); ++i) {
+    swapped = static_cast<bits_type>((swapped << 8) | (bits & 0xff));
+    bits = static_cast<bits_type>(bits >> 8);
+  }
+  T result;
+  std::memcpy(&result, &swapped, sizeof(result));
+  return result;
+}
+
+template <typename T>
+void byte_swap_n(T *values, const std::size_t n) noexcept {
+  for (std::size_t i{0}; i < n; ++i) {
+    values[i] = byte_swap(values[i]);
+  }
+}
+
+template <typename From, typename Round>
+void scale_and_round(From *values, const std::size_t n, const From scale,
+                     const From offset, Round round) noexcept {
+  for (std::size_t i{0}; i < n; ++i) {
+    values[i] = round(values[i] * scale + offset);
+  }
+}
+
+// Applies the options to n values of in and returns them. Returns in itself if
+// there is nothing to apply and otherwise uses buffer.
+template <typename From>
+const From *prepare(const From *in, const std::size_t n,
+                    const options &options, std::vector<From> &buffer) {
+  const bool swap{options.input_order != byte_order::native};
+  const bool transform{options.scale != 1.0 || options.offset != 0.0 ||
+                       options.round != rounding::toward_zero};
+  if (!swap && !transform) {
+    return in;
+  }
+  buffer.resize(n);
+  From *values{buffer.data()};
+  std::memcpy(values, in, n * sizeof(From));
+  if (swap) {
+    byte_swap_n(values, n);
+  }
+  const auto scale = static_cast<From>(options.scale);
+  const auto offset = static_cast<From>(options.offset);
+  switch (options.round) {
+  case rounding::toward_zero:
+    // clamp_cast truncates.
+    scale_and_round(values, n, scale, offset, [](From x) { return x; });
+    break;
+  case rounding::downward:
+    scale_and_round(values, n, scale, offset,
+                    [](From x) { return std::floor(x); });
+    break;
+  case rounding::upward:
+    scale_and_round(values, n, scale, offset,
+                    [](From x) { return std::ceil(x); });
+    break;
+  case rounding::to_nearest:
+    scale_and_round(values, n, scale, offset,
+                    [](From x) { return std::nearbyint(x); });
+    break;
+  case rounding::to_nearest_away:
+    scale_and_round(values, n, scale, offset,
+                    [](From x) { return std::round(x); });
+    break;
+  }
+  return values;
+}
+
+// Converts n values and adds the clamped ones to counts. Like the chunks of
+// parallel::clamp_cast_n the chunks are small enough for the buffers to stay
+// in the cache.
+template <typename To, typename From>
+void convert_chunk(const From *in, const std::size_t n, To *out,
+                   const options &options, result &counts) {
+  thread_local std::vector<From> buffer;
+  const From *values{prepare(in, n, options, buffer)};
+  const auto summary = checked_clamp_cast_n(values, n, out, nullptr);
+  counts.values += n;
+  counts.bytes += n * (sizeof(From) + sizeof(To));
+  counts.nans += summary.nans;
+  counts.underflows += summary.underflows;
+  counts.overflows += summary.overflows;
+  if (options.output_order != byte_order::native) {
+    byte_swap_n(out, n);
+  }
+}
+
+inline unsigned thread_count(const options &options) noexcept {
+  const unsigned threads{options.threads != 0
+                             ? options.threads
+                             : std::thread::hardware_concurrency()};
+  return std::max(1u, threads);
+}
+
+// The number of values of From in the bytes of a file after offset.
+template <typename From>
+std::size_t value_count(const char *path, const std::size_t size,
+                        const std::size_t offset) {
+  if (size < offset || (size - offset) % sizeof(From) != 0) {
+    throw std::invalid_argument{std::string{path} +
+                                " does not hold whole values"};
+  }
+  return (size - offset) / sizeof(From);
+}
+
+// Converts n values in chunks on the pool and adds the counts to total.
+template <typename To, typename From>
+void convert_values(const From *in, const std::size_t n, To *out,
+                    const options &options, parallel::thread_pool &pool,
+                    result &total) {
+  constexpr auto chunk = parallel::chunk_size<From>;
+  const std::size_t chunks{(n + chunk - 1) / chunk};
+  std::vector<result> counts(chunks);
+  pool.for_each_index(chunks, [&](const std::size_t c) {
+    const std::size_t begin{c * chunk};
+    convert_chunk(in + begin, std::min(chunk, n - begin), out + begin, options,
+                  counts[c]);
+  });
+  for (const auto &c : counts) {
+    total.values += c.values;
+    total.bytes += c.bytes;
+    total.nans += c.nans;
+    total.underflows += c.underflows;
+    total.overflows += c.overflows;
+  }
+}
+
+// Converts n values at in_offset bytes of in_file to out_offset bytes of
+// out_file, which grows to hold them. The offsets must be multiples of the
+// sizes of the types.
+template <typename To, typename From>
+void convert_mapped(const descriptor &in_file, const std::size_t in_offset,
+                    const descriptor &out_file, const std::size_t out_offset,
+                    const std::size_t n, const options &options,
+                    result &total) {
+  const std::size_t out_size{out_offset + n * sizeof(To)};
+  if (::ftruncate(out_file.get(), static_cast<off_t>(out_size)) != 0) {
+    throw_errno("ftruncate");
+  }
+  if (n == 0) {
+    return;
+  }
+  const mapping in_map{in_file, in_offset + n * sizeof(From), PROT_READ};
+  const mapping out_map{out_file, out_size, PROT_READ | PROT_WRITE};
+  const auto *in = reinterpret_cast<const From *>(
+      static_cast<const std::byte *>(in_map.get()) + in_offset);
+  auto *out = reinterpret_cast<To *>(static_cast<std::byte *>(out_map.get()) +
+                                     out_offset);
+  parallel::thread_pool pool{thread_count(options) - 1};
+  convert_values(in, n, out, options, pool, total);
+}
+
+} // namespace detail
+
+// Converts the file at input of values of From to a file at output of values
+// of To, which is created or truncated. Errors of the system calls throw
+// std::system_error. An input whose size is not a multiple of the size of From
+// or that is the output throws std::invalid_argument.
+template <typename To, typename From>
+result convert(const char *input, const char *output,
+               const options &options = {}) {
+  static_assert(std::is_floating_point_v<From> && std::is_integral_v<To>);
+  const auto start = std::chrono::steady_clock::now();
+  result total;
+  {
+    const detail::descriptor in_file{input, O_RDONLY};
+    const std::size_t n{detail::value_count<From>(input, in_file.size(), 0)};
+    const detail::descriptor out_file{output, O_RDWR | O_CREAT, 0644};
+    detail::truncate_output(in_file, out_file, output);
+    detail::convert_mapped<To, From>(in_file, 0, out_file, 0, n, options,
+                                     total);
+  }
+  total.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return total;
+}
+
+} // namespace clamp_cast::file
+
+#endif
+
+#endif
@@ -0,0 +1,497 @@
+#ifndef CLAMP_CAST_NPY_HPP
+#define CLAMP_CAST_NPY_HPP
+
+// Reads and writes the .npy files of NumPy without depending on it and
+// converts their dtype with the bulk kernels. npy::convert converts the values
+// of a file of float32 or float64 straight into the values of a new .npy file
+// of an integer dtype, mapped like file::convert or pipelined like
+// file::convert_pipelined, without a copy of the array in between. npy::load
+// converts them straight into a vector.
+//
+// The values are converted element by element so the shape and the order of
+// the array, C or Fortran, stay the same and are written to the new header.
+// Both byte orders are read, and the new file is written in the byte order of
+// file::options::output_order.
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "clamp-cast-file.hpp"
+#include "clamp-cast-parallel.hpp"
+#include "clamp-cast-pipeline.hpp"
+
+namespace clamp_cast::npy {
+
+// The header of a .npy file.
+struct header {
+  // The dtype as in the file, for example "<f4".
+  std::string descr;
+  bool fortran_order{false};
+  std::vector<std::size_t> shape;
+  // The offset of the values in the file.
+  std::size_t data_offset{0};
+
+  // The number of values, which is 1 for an array without dimensions. Throws
+  // std::invalid_argument if it does not fit into std::size_t.
+  std::size_t count() const {
+    std::size_t n{1};
+    for (const auto dimension : shape) {
+      if (dimension == 0) {
+        return 0;
+      }
+    }
+    for (const auto dimension : shape) {
+      if (n > std::numeric_limits<std::size_t>::max() / dimension) {
+        throw std::invalid_argument{"npy: the shape has too many values"};
+      }
+      n *= dimension;
+    }
+    return n;
+  }
+};
+
+// The descr of the dtype of T in the given byte order, for example "<i2".
+template <typename T>
+std::string descr(const file::byte_order order = file::byte_order::native) {
+  static_assert(std::is_arithmetic_v<T>);
+  const char kind{std::is_same_v<T, bool>       ? 'b'
+                  : std::is_floating_point_v<T> ? 'f'
+                  : std::is_signed_v<T>         ? 'i'
+                                                : 'u'};
+  const char byte_order{sizeof(T) == 1                     ? '|'
+                        : order == file::byte_order::little ? '<'
+                                                            : '>'};
+  return std::string{byte_order, kind} + std::to_string(sizeof(T));
+}
+
+namespace detail {
+
+constexpr char magic[]{"\x93NUMPY"};
+constexpr std::size_t magic_size{6};
+
+// The dict of the header, for example
+// {'descr': '<f4', 'fortran_order': False, 'shape': (3, 4), }
+class dict_parser {
+public:
+  explicit dict_parser(const std::string &text) : text_{text} {}
+
+  void parse(header &h) {
+    expect('{');
+    bool descr{false};
+    bool fortran_order{false};
+    bool shape{false};
+    while (!accept('}')) {
+      const std::string key{parse_string()};
+      expect(':');
+      if (key == "descr") {
+        if (peek() != '\'' && peek() != '"') {
+          fail("only simple dtypes are supported");
+        }
+        h.descr = parse_string();
+        descr = true;
+      } else if (key == "fortran_order") {
+        h.fortran_order = parse_bool();
+        fortran_order = true;
+      } else if (key == "shape") {
+        h.shape = parse_shape();
+        shape = true;
+      } else {
+        fail("unknown key " + key);
+      }
+      if (!accept(',')) {
+        expect('}');
+        break;
+      }
+    }
+    if (!descr || !fortran_order || !shape) {
+      fail("missing key");
+    }
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &what) const {
+    throw std::invalid_argument{"npy header: " + what};
+  }
+
+  char peek() {
+    while (position_ < text_.size() &&
+           (text_[position_] == ' ' || text_[position_] == '\n')) {
+      ++position_;
+    }
+    return position_ < text_.size() ? text_[position_] : '\0';
+  }
+
+  bool accept(const char c) {
+    if (peek() != c) {
+      return false;
+    }
+    ++position_;
+    return true;
+  }
+
+  void expect(const char c) {
+    if (!accept(c)) {
+      fail(std::string{"expected "} + c);
+    }
+  }
+
+  std::string parse_string() {
+    const char quote{peek()};
+    if (quote != '\'' && quote != '"') {
+      fail("expected a string");
+    }
+    const auto end = text_.find(quote, ++position_);
+    if (end == std::string::npos) {
+      fail("unterminated string");
+    }
+    std::string value{text_.substr(position_, end - position_)};
+    position_ = end + 1;
+    return value;
+  }
+
+  bool parse_bool() {
+    peek();
+    for (const auto &[word, value] : {std::pair{"True", true},
+                                      std::pair{"False", false}}) {
+      if (text_.compare(position_, std::char_traits<char>::length(word),
+                        word) == 0) {
+        position_ += std::char_traits<char>::length(word);
+        return value;
+      }
+    }
+    fail("expected True or False");
+  }
+
+  // A tuple of integers like (3,) or (). Python 2 wrote 3L.
+  std::vector<std::size_t> parse_shape() {
+    std::vector<std::size_t> shape;
+    expect('(');
+    while (!accept(')')) {
+      peek();
+      std::size_t dimension{0};
+      const std::size_t begin{position_};
+      while (position_ < text_.size() && text_[position_] >= '0' &&
+             text_[position_] <= '9') {
+        const auto digit = static_cast<std::size_t>(text_[position_] - '0');
+        constexpr auto max = std::numeric_limits<std::size_t>::max();
+        if (dimension > (max - digit) / 10) {
+          fail("dimension too large");
+        }
+        dimension = dimension * 10 + digit;
+        ++position_;
+      }
+      if (position_ == begin) {
+        fail("expected a dimension");
+      }
+      accept('L');
+      shape.push_back(dimension);
+      if (!accept(',')) {
+        expect(')');
+        break;
+      }
+    }
+    return shape;
+  }
+
+  const std::string &text_;
+  std::size_t position_{0};
+};
+
+inline void read_exactly(const file::detail::descriptor &file, char *data,
+                         std::size_t size, std::size_t offset) {
+  while (size != 0) {
+    const ssize_t done{
+        ::pread(file.get(), data, size, static_cast<off_t>(offset))};
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      file::detail::throw_errno("pread");
+    }
+    if (done == 0) {
+      throw std::invalid_argument{"npy: the file ends in the header"};
+    }
+    data += done;
+    size -= static_cast<std::size_t>(done);
+    offset += static_cast<std::size_t>(done);
+  }
+}
+
+inline void write_all(const file::detail::descriptor &file,
+                      const std::string &data) {
+  std::size_t written{0};
+  while (written < data.size()) {
+    const ssize_t done{::pwrite(file.get(), data.data() + written,
+                                data.size() - written,
+                                static_cast<off_t>(written))};
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      file::detail::throw_errno("pwrite");
+    }
+    written += static_cast<std::size_t>(done);
+  }
+}
+
+inline header read_header(const file::detail::descriptor &file) {
+  // The magic, the version and the length of the header, which has 2 bytes in
+  // version 1 and 4 bytes in versions 2 and 3.
+  char preamble[12];
+  read_exactly(file, preamble, 10, 0);
+  if (std::string{preamble, magic_size} != magic) {
+    throw std::invalid_argument{"npy: not a .npy file"};
+  }
+  const auto major = static_cast<unsigned char>(preamble[magic_size]);
+  std::size_t length_size;
+  if (major == 1) {
+    length_size = 2;
+  } else if (major == 2 || major == 3) {
+    length_size = 4;
+    read_exactly(file, preamble + 10, 2, 10);
+  } else {
+    throw std::invalid_argument{"npy: unknown version " +
+                                std::to_string(major)};
+  }
+  std::size_t length{0};
+  for (std::size_t i{length_size}; i-- > 0;) {
+    length = length << 8 |
+             static_cast<unsigned char>(preamble[magic_size + 2 + i]);
+  }
+  std::string text(length, '\0');
+  const std::size_t offset{magic_size + 2 + length_size};
+  read_exactly(file, text.data(), length, offset);
+  header h;
+  dict_parser{text}.parse(h);
+  h.data_offset = offset + length;
+  return h;
+}
+
+// The byte order, kind and size of a simple descr.
+struct dtype {
+  file::byte_order order;
+  char kind;
+  std::size_t size;
+};
+
+inline dtype parse_descr(const std::string &descr) {
+  if (descr.size() < 3 ||
+      descr.find_first_not_of("0123456789", 2) != std::string::npos) {
+    throw std::invalid_argument{"npy: unsupported dtype " + descr};
+  }
+  dtype type{file::byte_order::native, descr[1],
+             static_cast<std::size_t>(std::stoul(descr.substr(2)))};
+  if (descr[0] == '<') {
+    type.order = file::byte_order::little;
+  } else if (descr[0] == '>') {
+    type.order = file::byte_order::big;
+  } else if (descr[0] != '=' && descr[0] != '|') {
+    throw std::invalid_argument{"npy: unsupported dtype " + descr};
+  }
+  return type;
+}
+
+} // namespace detail
+
+// The magic, version, length and dict of a header for the values that follow.
+// The header is padded with spaces to a multiple of 64 bytes like NumPy does
+// so that the values are aligned.
+inline std::string format_header(const std::string &descr,
+                                 const bool fortran_order,
+                                 const std::vector<std::size_t> &shape) {
+  std::string dict{"{'descr': '" + descr + "', 'fortran_order': " +
+                   (fortran_order ? "True" : "False") + ", 'shape': ("};
+  for (std::size_t i{0}; i < shape.size(); ++i) {
+    dict += (i == 0 ? "" : ", ") + std::to_string(shape[i]);
+  }
+  // A tuple of one element needs a comma.
+  dict += shape.size() == 1 ? ",), }" : "), }";
+  // Version 1 stores the length in 2 bytes and version 2 in 4.
+  const bool version_1{detail::magic_size + 4 + dict.size() + 64 <= 65535};
+  const std::size_t preamble{detail::magic_size + (version_1 ? 4 : 6)};
+  const std::size_t padded{(preamble + dict.size() + 1 + 63) / 64 * 64};
+  dict.append(padded - preamble - dict.size() - 1, ' ');
+  dict += '\n';
+  std::string result{detail::magic, detail::magic_size};
+  result += static_cast<char>(version_1 ? 1 : 2);
+  result += '\0';
+  for (std::size_t i{0}; i < (version_1 ? 2u : 4u); ++i) {
+    result += static_cast<char>((dict.size() >> (8 * i)) & 0xff);
+  }
+  return result + dict;
+}
+
+namespace detail {
+
+// Opens input, checks that it holds float32 or float64 values and calls
+// convert(from, in_file, h, n, options) with a null pointer of their type and
+// options for their byte order.
+template <typename Convert>
+void with_input(const char *input, const file::options &options,
+                Convert convert) {
+  const file::detail::descriptor in_file{input, O_RDONLY};
+  const header h{read_header(in_file)};
+  const dtype type{parse_descr(h.descr)};
+  file::options in_options{options};
+  in_options.input_order = type.order;
+  const auto run = [&](auto *from) {
+    using From = std::remove_pointer_t<decltype(from)>;
+    const std::size_t n{file::detail::value_count<From>(input, in_file.size(),
+                                                        h.data_offset)};
+    if (n != h.count() || h.data_offset % sizeof(From) != 0) {
+      throw std::invalid_argument{std::string{input} +
+                                  " does not match its header"};
+    }
+    convert(from, in_file, h, n, in_options);
+  };
+  if (type.kind == 'f' && type.size == 4) {
+    run(static_cast<float *>(nullptr));
+  } else if (type.kind == 'f' && type.size == 8) {
+    run(static_cast<double *>(nullptr));
+  } else {
+    throw std::invalid_argument{"npy: only float32 and float64 are converted, "
+                                "not " +
+                                h.descr};
+  }
+}
+
+template <typename To, typename Convert>
+file::result convert_file(const char *input, const char *output,
+                          const file::options &options, Convert convert) {
+  static_assert(std::is_integral_v<To>);
+  const auto start = std::chrono::steady_clock::now();
+  file::result total;
+  with_input(input, options,
+             [&](auto *from, const file::detail::descriptor &in_file,
+                 const header &h, const std::size_t n,
+                 const file::options &in_options) {
+               const std::string out_header{format_header(
+                   descr<To>(options.output_order), h.fortran_order, h.shape)};
+               const file::detail::descriptor out_file{
+                   output, O_RDWR | O_CREAT, 0644};
+               file::detail::truncate_output(in_file, out_file, output);
+               write_all(out_file, out_header);
+               convert(from, in_file, h.data_offset, out_file,
+                       out_header.size(), n, in_options, total);
+             });
+  total.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return total;
+}
+
+} // namespace detail
+
+inline header read_header(const char *path) {
+  return detail::read_header(file::detail::descriptor{path, O_RDONLY});
+}
+
+// Writes count() values of shape in native byte order.
+template <typename T>
+void save(const char *path, const T *data,
+          const std::vector<std::size_t> &shape,
+          const bool fortran_order = false) {
+  const std::string h{format_header(descr<T>(), fortran_order, shape)};
+  const std::size_t n{header{descr<T>(), fortran_order, shape, 0}.count()};
+  std::ofstream file{path, std::ios::binary};
+  file.write(h.data(), static_cast<std::streamsize>(h.size()));
+  file.write(reinterpret_cast<const char *>(data),
+             static_cast<std::streamsize>(n * sizeof(T)));
+  if (!file) {
+    throw std::runtime_error{std::string{"cannot write "} + path};
+  }
+}
+
+// Converts the .npy file at input of float32 or float64 to a .npy file at
+// output of To with mappings like file::convert. input_order of the options is
+// taken from the header.
+template <typename To>
+file::result convert(const char *input, const char *output,
+                     const file::options &options = {}) {
+  return detail::convert_file<To>(
+      input, output, options,
+      [](auto *from, const file::detail::descriptor &in_file,
+         const std::size_t in_offset, const file::detail::descriptor &out_file,
+         const std::size_t out_offset, const std::size_t n,
+         const file::options &in_options, file::result &total) {
+        file::detail::convert_mapped<To, std::remove_pointer_t<decltype(from)>>(
+            in_file, in_offset, out_file, out_offset, n, in_options, total);
+      });
+}
+
+// The same with the pipeline of file::convert_pipelined.
+template <typename To>
+file::result convert_pipelined(const char *input, const char *output,
+                               const file::options &options = {},
+                               const file::pipeline_options &pipeline = {}) {
+  return detail::convert_file<To>(
+      input, output, options,
+      [&pipeline](auto *from, const file::detail::descriptor &in_file,
+                  const std::size_t in_offset,
+                  const file::detail::descriptor &out_file,
+                  const std::size_t out_offset, const std::size_t n,
+                  const file::options &in_options, file::result &total) {
+        file::detail::convert_pipelined<To,
+                                        std::remove_pointer_t<decltype(from)>>(
+            in_file, in_offset, out_file, out_offset, n, in_options, pipeline,
+            total);
+      });
+}
+
+// An array that load converted.
+template <typename To> struct array {
+  // The header of the file.
+  npy::header header;
+  std::vector<To> values;
+  file::result counts;
+};
+
+// Maps the .npy file at path of float32 or float64 and converts its values
+// into the vector of the result. The values are in native byte order whatever
+// output_order of the options is.
+template <typename To> array<To> load(const char *path,
+                                      const file::options &options = {}) {
+  static_assert(std::is_integral_v<To>);
+  array<To> result;
+  detail::with_input(
+      path, options,
+      [&](auto *from, const file::detail::descriptor &in_file,
+          const header &h, const std::size_t n,
+          file::options in_options) {
+        using From = std::remove_pointer_t<decltype(from)>;
+        in_options.output_order = file::byte_order::native;
+        result.header = h;
+        result.values.resize(n);
+        if (n == 0) {
+          return;
+        }
+        const file::detail::mapping in_map{
+            in_file, h.data_offset + n * sizeof(From), PROT_READ};
+        const auto *in = reinterpret_cast<const From *>(
+            static_cast<const std::byte *>(in_map.get()) + h.data_offset);
+        parallel::thread_pool pool{file::detail::thread_count(in_options) - 1};
+        file::detail::convert_values(in, n, result.values.data(), in_options,
+                                     pool, result.counts);
+      });
+  return result;
+}
+
+} // namespace clamp_cast::npy
+
+#endif
+
+#endif
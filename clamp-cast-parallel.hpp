@@ -0,0 +1,354 @@
+#ifndef CLAMP_CAST_PARALLEL_HPP
+#define CLAMP_CAST_PARALLEL_HPP
+
+// Converts large arrays on several threads. The array is split into chunks of
+// 64 KiB of input that are converted independently, so the output is the same
+// as that of clamp_cast_n no matter which thread converts which chunk.
+//
+// The chunks are distributed by a work-stealing thread_pool: every thread
+// starts with a contiguous range of chunks and threads that finish early take
+// half of the remaining chunks of another thread. Callers that already have a
+// thread pool can pass any executor with the member function of thread_pool
+// that runs the chunks, see clamp_cast_n below.
+//
+// clamp_cast::clamp_cast_n also takes an execution policy like the parallel
+// algorithms of the standard library, see clamp_cast::execution. Defining
+// CLAMP_CAST_STD_EXECUTION adds the policies of <execution>, which needs TBB
+// to be linked with libstdc++ when it is installed.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef CLAMP_CAST_STD_EXECUTION
+#include <execution>
+#endif
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast::parallel {
+
+class thread_pool {
+public:
+  // A pool with the given number of threads in addition to the thread that
+  // calls for_each_index.
+  explicit thread_pool(const unsigned workers) : ranges_(workers + 1) {
+    threads_.reserve(workers);
+    for (unsigned i{0}; i < workers; ++i) {
+      threads_.emplace_back([this, i] { work_loop(i); });
+    }
+  }
+
+  // A pool that uses every hardware thread.
+  thread_pool()
+      : thread_pool{std::max(1u, std::thread::hardware_concurrency()) - 1} {}
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  ~thread_pool() {
+    {
+      const std::lock_guard<std::mutex> lock{mutex_};
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // The number of threads that run the indices, including the caller.
+  unsigned concurrency() const noexcept {
+    return static_cast<unsigned>(ranges_.size());
+  }
+
+  // Calls f(i) for every i in [0, count) on the threads of the pool and the
+  // calling thread and returns when all calls have returned. f must not throw.
+  // Calls from several threads are run one after the other.
+  template <typename F> void for_each_index(const std::size_t count, F &&f) {
+    const std::lock_guard<std::mutex> run_lock{run_mutex_};
+    if (threads_.empty() || count <= 1) {
+      for (std::size_t i{0}; i < count; ++i) {
+        f(i);
+      }
+      return;
+    }
+    const std::size_t participants{ranges_.size()};
+    for (std::size_t p{0}; p < participants; ++p) {
+      const std::lock_guard<std::mutex> lock{ranges_[p].mutex};
+      ranges_[p].begin = count * p / participants;
+      ranges_[p].end = count * (p + 1) / participants;
+    }
+    {
+      const std::lock_guard<std::mutex> lock{mutex_};
+      task_ = &f;
+      call_ = [](void *task, const std::size_t i) {
+        (*static_cast<std::remove_reference_t<F> *>(task))(i);
+      };
+      busy_ = static_cast<unsigned>(threads_.size());
+      ++generation_;
+    }
+    wake_.notify_all();
+    // The caller uses the last range.
+    work(participants - 1);
+    std::unique_lock<std::mutex> lock{mutex_};
+    done_.wait(lock, [this] { return busy_ == 0; });
+  }
+
+private:
+  // The indices [begin, end) that a thread has yet to run.
+  struct range {
+    std::mutex mutex;
+    std::size_t begin{0};
+    std::size_t end{0};
+  };
+
+  void work_loop(const unsigned self) {
+    std::uint64_t seen{0};
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock{mutex_};
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+      }
+      work(self);
+      {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        if (--busy_ == 0) {
+          done_.notify_one();
+        }
+      }
+    }
+  }
+
+  // Runs the indices of the own range and then steals from the others until
+  // no range has indices left.
+  void work(const std::size_t self) {
+    std::size_t i{0};
+    for (;;) {
+      if (pop(self, i)) {
+        call_(task_, i);
+      } else if (!steal(self)) {
+        return;
+      }
+    }
+  }
+
+  bool pop(const std::size_t self, std::size_t &i) {
+    auto &own = ranges_[self];
+    const std::lock_guard<std::mutex> lock{own.mutex};
+    if (own.begin == own.end) {
+      return false;
+    }
+    i = own.begin++;
+    return true;
+  }
+
+  // Moves the second half of the indices of another range to the own one. At
+  // most one range is locked at a time.
+  bool steal(const std::size_t self) {
+    const std::size_t participants{ranges_.size()};
+    for (std::size_t offset{1}; offset < participants; ++offset) {
+      auto &victim = ranges_[(self + offset) % participants];
+      std::size_t begin;
+      std::size_t end;
+      {
+        const std::lock_guard<std::mutex> lock{victim.mutex};
+        const std::size_t remaining{victim.end - victim.begin};
+        if (remaining == 0) {
+          continue;
+        }
+        end = victim.end;
+        begin = end - (remaining + 1) / 2;
+        victim.end = begin;
+      }
+      auto &own = ranges_[self];
+      const std::lock_guard<std::mutex> lock{own.mutex};
+      own.begin = begin;
+      own.end = end;
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<range> ranges_;
+  std::vector<std::thread> threads_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  void *task_{nullptr};
+  void (*call_)(void *, std::size_t){nullptr};
+  std::uint64_t generation_{0};
+  unsigned busy_{0};
+  bool stop_{false};
+};
+
+// The pool that clamp_cast_n uses when no executor is given. It is created on
+// first use with a thread for every hardware thread.
+inline thread_pool &default_pool() {
+  static thread_pool pool;
+  return pool;
+}
+
+// The number of values that are converted at once by one thread.
+template <typename From>
+constexpr std::size_t chunk_size{(std::size_t{1} << 16) / sizeof(From)};
+
+// clamp_cast_n on the threads of an executor. The executor can be a
+// thread_pool or any object with a member function for_each_index(count, f)
+// that calls f(i) for every i in [0, count) and returns when all calls are
+// done.
+//
+// The policy must not throw and is called from several threads at once. The
+// events of sticky are collected per chunk and raised in its flags once at the
+// end so that sticky can be used as is.
+template <engine Engine = engine::automatic, typename Executor, typename From,
+          typename To, typename Policy = policy<>>
+void clamp_cast_n(Executor &executor, const From *in, const std::size_t n,
+                  To *out, const Policy &policy = {} CLAMP_CAST_CALL_SITE) {
+  static_assert(clamp_cast::detail::is_nothrow_policy<To, Policy>,
+                "the policy must not throw on other threads");
+  CLAMP_CAST_RECORD_N(To, in, n);
+  CLAMP_CAST_PROFILE_N(To, in, n);
+  constexpr auto chunk = chunk_size<From>;
+  const std::size_t chunks{(n + chunk - 1) / chunk};
+  // The chunks are smaller than streaming_threshold so engine::streaming
+  // decides for the whole array.
+  const bool streaming{Engine == engine::streaming &&
+                       n * sizeof(To) >= streaming_threshold};
+  const auto convert = [&](const std::size_t c, const auto &chunk_policy) {
+    const std::size_t begin{c * chunk};
+    const std::size_t count{std::min(chunk, n - begin)};
+    if (streaming) {
+      clamp_cast::detail::clamp_cast_n_streaming(in + begin, count, out + begin,
+                                                 chunk_policy);
+    } else {
+      clamp_cast::detail::clamp_cast_n_engine<Engine>(
+          in + begin, count, out + begin, chunk_policy);
+    }
+  };
+  if constexpr (std::is_same_v<Policy, sticky>) {
+    std::atomic<unsigned> events{0};
+    executor.for_each_index(chunks, [&](const std::size_t c) {
+      saturation_flags flags;
+      convert(c, sticky{flags});
+      events.fetch_or(flags.bits(), std::memory_order_relaxed);
+    });
+    policy.flags().raise(events.load(std::memory_order_relaxed));
+  } else {
+    executor.for_each_index(chunks,
+                            [&](const std::size_t c) { convert(c, policy); });
+  }
+}
+
+// clamp_cast_n on the default_pool.
+template <engine Engine = engine::automatic, typename From, typename To,
+          typename Policy = policy<>>
+void clamp_cast_n(const From *in, const std::size_t n, To *out,
+                  const Policy &policy = {} CLAMP_CAST_CALL_SITE) {
+  parallel::clamp_cast_n<Engine>(default_pool(), in, n, out,
+                                 policy CLAMP_CAST_FORWARD_CALL_SITE);
+}
+
+} // namespace clamp_cast::parallel
+
+namespace clamp_cast::execution {
+
+// Execution policies like the ones of <execution>.
+struct sequenced_policy {};
+struct unsequenced_policy {};
+struct parallel_policy {};
+struct parallel_unsequenced_policy {};
+
+inline constexpr sequenced_policy seq{};
+inline constexpr unsequenced_policy unseq{};
+inline constexpr parallel_policy par{};
+inline constexpr parallel_unsequenced_policy par_unseq{};
+
+// How clamp_cast_n converts with an execution policy: the engine and whether
+// the chunks are distributed over the default_pool. Sequenced policies convert
+// the elements one after the other with the scalar engine so that the policy
+// is called in order.
+template <typename ExecutionPolicy> struct traits;
+
+template <> struct traits<sequenced_policy> {
+  static constexpr engine bulk_engine{engine::scalar};
+  static constexpr bool parallel{false};
+};
+
+template <> struct traits<unsequenced_policy> {
+  static constexpr engine bulk_engine{engine::automatic};
+  static constexpr bool parallel{false};
+};
+
+template <> struct traits<parallel_policy> {
+  static constexpr engine bulk_engine{engine::scalar};
+  static constexpr bool parallel{true};
+};
+
+template <> struct traits<parallel_unsequenced_policy> {
+  static constexpr engine bulk_engine{engine::automatic};
+  static constexpr bool parallel{true};
+};
+
+#ifdef CLAMP_CAST_STD_EXECUTION
+template <>
+struct traits<std::execution::sequenced_policy> : traits<sequenced_policy> {};
+template <>
+struct traits<std::execution::parallel_policy> : traits<parallel_policy> {};
+template <>
+struct traits<std::execution::parallel_unsequenced_policy>
+    : traits<parallel_unsequenced_policy> {};
+#if __cpp_lib_execution >= 201902L
+template <>
+struct traits<std::execution::unsequenced_policy>
+    : traits<unsequenced_policy> {};
+#endif
+#endif
+
+template <typename T, typename = void>
+constexpr bool is_execution_policy{false};
+
+template <typename T>
+constexpr bool
+    is_execution_policy<T, std::void_t<decltype(traits<T>::parallel)>>{true};
+
+} // namespace clamp_cast::execution
+
+namespace clamp_cast {
+
+// clamp_cast_n with an execution policy, for example
+// clamp_cast_n(execution::par_unseq, in, n, out). The parallel policies use
+// parallel::clamp_cast_n on the default_pool and need a policy that does not
+// throw.
+template <typename ExecutionPolicy, typename From, typename To,
+          typename Policy = policy<>,
+          typename = std::enable_if_t<
+              execution::is_execution_policy<std::decay_t<ExecutionPolicy>>>>
+void clamp_cast_n(ExecutionPolicy &&, const From *in, const std::size_t n,
+                  To *out, const Policy &policy = {} CLAMP_CAST_CALL_SITE) {
+  using traits = execution::traits<std::decay_t<ExecutionPolicy>>;
+  if constexpr (traits::parallel) {
+    parallel::clamp_cast_n<traits::bulk_engine>(
+        parallel::default_pool(), in, n, out,
+        policy CLAMP_CAST_FORWARD_CALL_SITE);
+  } else {
+    clamp_cast_n<traits::bulk_engine>(in, n, out,
+                                      policy CLAMP_CAST_FORWARD_CALL_SITE);
+  }
+}
+
+} // namespace clamp_cast
+
+#endif
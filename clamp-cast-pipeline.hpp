@@ -0,0 +1,529 @@
+#ifndef CLAMP_CAST_PIPELINE_HPP
+#define CLAMP_CAST_PIPELINE_HPP
+
+// Converts files like file::convert but reads and writes them with explicit
+// I/O instead of mapping them, for inputs that are too large or too cold for
+// the page cache to keep up. The file is converted in chunks that rotate
+// through a few buffers: while one chunk is converted the next ones are read
+// and the previous ones are written. The reads and writes go through io_uring
+// if the kernel has it, with the raw system calls so that liburing is not
+// needed, and otherwise through a reader and a writer thread with pread and
+// pwrite.
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "clamp-cast-file.hpp"
+#include "clamp-cast-parallel.hpp"
+
+namespace clamp_cast::file {
+
+enum class io {
+  // io_uring if the kernel allows it, otherwise threads.
+  automatic,
+  uring,
+  threads,
+};
+
+struct pipeline_options {
+  // The size of the input of one chunk.
+  std::size_t buffer_size{std::size_t{4} << 20};
+  // The number of chunks in flight: 2 for double and 3 for triple buffering.
+  unsigned buffers{3};
+  io backend{io::automatic};
+  // Drops the input from the page cache once it has been converted and starts
+  // writing the output back once it has been written, so that a file larger
+  // than the memory does not push everything else out of the cache. Off by
+  // default because it also evicts pages of the input that others may use.
+  bool drop_cache{false};
+};
+
+namespace detail {
+
+// A read or write of a whole buffer at an offset of a file.
+struct io_request {
+  int fd;
+  bool write;
+  std::byte *data;
+  std::size_t size;
+  std::size_t offset;
+};
+
+// io_uring without liburing. The pipeline has at most one request per buffer
+// in flight so the rings never overflow. Short reads and writes are continued
+// here so that wait only returns requests that are done. The destructor waits
+// for the requests in flight so that the kernel is done with the buffers.
+class uring_io {
+public:
+  explicit uring_io(const unsigned requests) : requests_(requests) {
+    io_uring_params params{};
+    const long fd{::syscall(__NR_io_uring_setup, requests, &params)};
+    if (fd < 0) {
+      throw_errno("io_uring_setup");
+    }
+    fd_ = static_cast<int>(fd);
+    try {
+      map_rings(params);
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  uring_io(const uring_io &) = delete;
+  uring_io &operator=(const uring_io &) = delete;
+
+  ~uring_io() {
+    while (in_flight_ != 0 && reap()) {
+    }
+    release();
+  }
+
+  // Starts request number id, which must not be in flight.
+  void submit(const unsigned id, const io_request &request) {
+    requests_[id] = request;
+    push(id);
+  }
+
+  // Waits for a request to be done and returns its number.
+  unsigned wait() {
+    for (;;) {
+      if (!reap()) {
+        throw_errno("io_uring_enter");
+      }
+      auto &request = requests_[completed_id_];
+      if (completed_result_ < 0) {
+        errno = -completed_result_;
+        throw_errno(request.write ? "write" : "read");
+      }
+      if (completed_result_ == 0) {
+        throw std::runtime_error{"unexpected end of file"};
+      }
+      const auto done = static_cast<std::size_t>(completed_result_);
+      if (done == request.size) {
+        return completed_id_;
+      }
+      request.data += done;
+      request.size -= done;
+      request.offset += done;
+      push(completed_id_);
+    }
+  }
+
+private:
+  void map_rings(const io_uring_params &params) {
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ = map(sq_size_, IORING_OFF_SQ_RING);
+    cq_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0
+              ? sq_
+              : map(cq_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+    const auto at = [](void *ring, const unsigned offset) {
+      return reinterpret_cast<unsigned *>(static_cast<std::byte *>(ring) +
+                                          offset);
+    };
+    sq_tail_ = at(sq_, params.sq_off.tail);
+    sq_mask_ = *at(sq_, params.sq_off.ring_mask);
+    sq_array_ = at(sq_, params.sq_off.array);
+    cq_head_ = at(cq_, params.cq_off.head);
+    cq_tail_ = at(cq_, params.cq_off.tail);
+    cq_mask_ = *at(cq_, params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(static_cast<std::byte *>(cq_) +
+                                             params.cq_off.cqes);
+  }
+
+  void release() noexcept {
+    if (sqes_ != nullptr) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ != nullptr && cq_ != sq_) {
+      ::munmap(cq_, cq_size_);
+    }
+    if (sq_ != nullptr) {
+      ::munmap(sq_, sq_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  void *map(const std::size_t size, const long long offset) {
+    void *const memory{::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd_, offset)};
+    if (memory == MAP_FAILED) {
+      throw_errno("mmap");
+    }
+    return memory;
+  }
+
+  // Waits for the next completion and stores it in completed_id_ and
+  // completed_result_. Returns false if waiting failed.
+  bool reap() {
+    unsigned head{*cq_head_};
+    while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      if (::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS,
+                    nullptr, 0) < 0 &&
+          errno != EINTR) {
+        return false;
+      }
+    }
+    const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+    completed_id_ = static_cast<unsigned>(cqe.user_data);
+    completed_result_ = cqe.res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    --in_flight_;
+    return true;
+  }
+
+  void push(const unsigned id) {
+    const auto &request = requests_[id];
+    const unsigned tail{*sq_tail_};
+    const unsigned index{tail & sq_mask_};
+    io_uring_sqe &sqe = sqes_[index];
+    sqe = io_uring_sqe{};
+    sqe.opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe.fd = request.fd;
+    sqe.addr = reinterpret_cast<std::uintptr_t>(request.data);
+    // The size of one request fits in 32 bits because it is at most a
+    // buffer.
+    sqe.len = static_cast<std::uint32_t>(request.size);
+    sqe.off = request.offset;
+    sqe.user_data = id;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    while (::syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0) < 0) {
+      if (errno != EINTR) {
+        throw_errno("io_uring_enter");
+      }
+    }
+    ++in_flight_;
+  }
+
+  std::vector<io_request> requests_;
+  int fd_{-1};
+  void *sq_{nullptr};
+  void *cq_{nullptr};
+  io_uring_sqe *sqes_{nullptr};
+  std::size_t sq_size_{0};
+  std::size_t cq_size_{0};
+  std::size_t sqes_size_{0};
+  unsigned *sq_tail_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned *sq_array_{nullptr};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  io_uring_cqe *cqes_{nullptr};
+  unsigned completed_id_{0};
+  std::int32_t completed_result_{0};
+  unsigned in_flight_{0};
+};
+
+// The same with a reader and a writer thread so that reads and writes overlap
+// with each other and with the conversion.
+class thread_io {
+public:
+  explicit thread_io(const unsigned requests)
+      : requests_(requests), reader_{[this] { work(false); }},
+        writer_{[this] { work(true); }} {}
+
+  thread_io(const thread_io &) = delete;
+  thread_io &operator=(const thread_io &) = delete;
+
+  ~thread_io() {
+    {
+      const std::lock_guard<std::mutex> lock{mutex_};
+      stop_ = true;
+    }
+    work_.notify_all();
+    reader_.join();
+    writer_.join();
+  }
+
+  void submit(const unsigned id, const io_request &request) {
+    {
+      const std::lock_guard<std::mutex> lock{mutex_};
+      requests_[id] = request;
+      (request.write ? writes_ : reads_).push_back(id);
+    }
+    work_.notify_all();
+  }
+
+  unsigned wait() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    done_.wait(lock, [this] { return !completed_.empty(); });
+    const auto [id, error] = completed_.front();
+    completed_.pop_front();
+    if (error > 0) {
+      errno = error;
+      throw_errno(requests_[id].write ? "pwrite" : "pread");
+    }
+    if (error < 0) {
+      throw std::runtime_error{"unexpected end of file"};
+    }
+    return id;
+  }
+
+private:
+  void work(const bool write) {
+    auto &queue = write ? writes_ : reads_;
+    for (;;) {
+      io_request request;
+      unsigned id;
+      {
+        std::unique_lock<std::mutex> lock{mutex_};
+        work_.wait(lock, [&] { return stop_ || !queue.empty(); });
+        if (stop_) {
+          return;
+        }
+        id = queue.front();
+        queue.pop_front();
+        request = requests_[id];
+      }
+      const int error{transfer(request)};
+      {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        completed_.emplace_back(id, error);
+      }
+      done_.notify_one();
+    }
+  }
+
+  // Returns 0, errno or -1 at the end of the file.
+  static int transfer(io_request request) noexcept {
+    while (request.size != 0) {
+      const auto offset = static_cast<off_t>(request.offset);
+      const ssize_t done{
+          request.write
+              ? ::pwrite(request.fd, request.data, request.size, offset)
+              : ::pread(request.fd, request.data, request.size, offset)};
+      if (done < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno;
+      }
+      if (done == 0) {
+        return -1;
+      }
+      request.data += done;
+      request.size -= static_cast<std::size_t>(done);
+      request.offset += static_cast<std::size_t>(done);
+    }
+    return 0;
+  }
+
+  std::vector<io_request> requests_;
+  std::deque<unsigned> reads_;
+  std::deque<unsigned> writes_;
+  std::deque<std::pair<unsigned, int>> completed_;
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable done_;
+  bool stop_{false};
+  std::thread reader_;
+  std::thread writer_;
+};
+
+// Converts n values at in_offset bytes of in_fd to out_offset bytes of out_fd.
+// Chunk c uses buffer c % buffers. Request 2 * b reads into input buffer b and
+// request 2 * b + 1 writes from output buffer b. The read of chunk c + buffers
+// starts as soon as chunk c is converted, and only its conversion waits for
+// the write of chunk c. io is destroyed before the buffers.
+template <typename Io, typename To, typename From>
+void run_pipeline(const int in_fd, const std::size_t in_offset,
+                  const int out_fd, const std::size_t out_offset,
+                  const std::size_t n, const std::size_t chunk,
+                  const unsigned buffers, const options &options,
+                  const bool drop_cache, parallel::thread_pool &pool,
+                  result &total) {
+  const std::size_t chunks{(n + chunk - 1) / chunk};
+  std::vector<std::unique_ptr<From[]>> inputs;
+  std::vector<std::unique_ptr<To[]>> outputs;
+  for (unsigned b{0}; b < buffers; ++b) {
+    inputs.push_back(std::make_unique<From[]>(chunk));
+    outputs.push_back(std::make_unique<To[]>(chunk));
+  }
+  Io io{2 * buffers};
+  const auto count = [&](const std::size_t c) {
+    return std::min(chunk, n - c * chunk);
+  };
+  const auto in_position = [&](const std::size_t c) {
+    return in_offset + c * chunk * sizeof(From);
+  };
+  const auto out_position = [&](const std::size_t c) {
+    return out_offset + c * chunk * sizeof(To);
+  };
+  const auto read = [&](const std::size_t c) {
+    const unsigned b{static_cast<unsigned>(c % buffers)};
+    io.submit(2 * b,
+              {in_fd, false, reinterpret_cast<std::byte *>(inputs[b].get()),
+               count(c) * sizeof(From), in_position(c)});
+  };
+  std::vector<bool> read_done(buffers, false);
+  // Whether each output buffer is being written and which chunk it holds.
+  std::vector<bool> writing(buffers, false);
+  std::vector<std::size_t> written(buffers);
+  unsigned writes{0};
+  const auto handle = [&](const unsigned id) {
+    const unsigned b{id / 2};
+    if (id % 2 == 0) {
+      read_done[b] = true;
+      return;
+    }
+    writing[b] = false;
+    --writes;
+    if (drop_cache) {
+      const std::size_t c{written[b]};
+      ::sync_file_range(out_fd, static_cast<off_t>(out_position(c)),
+                        static_cast<off_t>(count(c) * sizeof(To)),
+                        SYNC_FILE_RANGE_WRITE);
+    }
+  };
+  for (std::size_t c{0}; c < std::min<std::size_t>(buffers, chunks); ++c) {
+    read(c);
+  }
+  for (std::size_t c{0}; c < chunks; ++c) {
+    const unsigned b{static_cast<unsigned>(c % buffers)};
+    while (!read_done[b] || writing[b]) {
+      handle(io.wait());
+    }
+    read_done[b] = false;
+    convert_values(inputs[b].get(), count(c), outputs[b].get(), options, pool,
+                   total);
+    if (drop_cache) {
+      ::posix_fadvise(in_fd, static_cast<off_t>(in_position(c)),
+                      static_cast<off_t>(count(c) * sizeof(From)),
+                      POSIX_FADV_DONTNEED);
+    }
+    io.submit(2 * b + 1,
+              {out_fd, true, reinterpret_cast<std::byte *>(outputs[b].get()),
+               count(c) * sizeof(To), out_position(c)});
+    writing[b] = true;
+    written[b] = c;
+    ++writes;
+    if (c + buffers < chunks) {
+      read(c + buffers);
+    }
+  }
+  while (writes != 0) {
+    handle(io.wait());
+  }
+}
+
+} // namespace detail
+
+// Whether io_uring can be used, which it cannot in some containers, when
+// kernel.io_uring_disabled is set and before Linux 5.6, which added
+// IORING_OP_READ and IORING_OP_WRITE together with the probe for them.
+inline bool uring_available() noexcept {
+  io_uring_params params{};
+  const long fd{::syscall(__NR_io_uring_setup, 1, &params)};
+  if (fd < 0) {
+    return false;
+  }
+  // io_uring_probe ends in a flexible array of one entry per opcode.
+  constexpr unsigned opcodes{IORING_OP_LAST};
+  alignas(io_uring_probe) std::byte
+      buffer[sizeof(io_uring_probe) + opcodes * sizeof(io_uring_probe_op)]{};
+  auto *const probe = reinterpret_cast<io_uring_probe *>(buffer);
+  const bool probed{::syscall(__NR_io_uring_register, fd,
+                              IORING_REGISTER_PROBE, probe, opcodes) == 0};
+  ::close(static_cast<int>(fd));
+  const auto supported = [&](const unsigned opcode) {
+    return opcode <= probe->last_op &&
+           (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+  };
+  return probed && supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+}
+
+namespace detail {
+
+// Like convert_mapped with the pipeline.
+template <typename To, typename From>
+void convert_pipelined(const descriptor &in_file, const std::size_t in_offset,
+                       const descriptor &out_file,
+                       const std::size_t out_offset, const std::size_t n,
+                       const options &options,
+                       const pipeline_options &pipeline, result &total) {
+  if (pipeline.buffers == 0) {
+    throw std::invalid_argument{"the pipeline needs a buffer"};
+  }
+  if (::ftruncate(out_file.get(),
+                  static_cast<off_t>(out_offset + n * sizeof(To))) != 0) {
+    throw_errno("ftruncate");
+  }
+  ::posix_fadvise(in_file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+  // Whole chunks of convert_values and at most 1 GiB per request.
+  constexpr auto piece = parallel::chunk_size<From>;
+  const std::size_t chunk{
+      std::clamp(pipeline.buffer_size / sizeof(From) / piece * piece, piece,
+                 (std::size_t{1} << 30) / sizeof(From))};
+  parallel::thread_pool pool{thread_count(options) - 1};
+  if (pipeline.backend == io::threads ||
+      (pipeline.backend == io::automatic && !uring_available())) {
+    run_pipeline<thread_io, To, From>(
+        in_file.get(), in_offset, out_file.get(), out_offset, n, chunk,
+        pipeline.buffers, options, pipeline.drop_cache, pool, total);
+  } else {
+    run_pipeline<uring_io, To, From>(
+        in_file.get(), in_offset, out_file.get(), out_offset, n, chunk,
+        pipeline.buffers, options, pipeline.drop_cache, pool, total);
+  }
+}
+
+} // namespace detail
+
+// file::convert with pipelined reads and writes instead of mappings. The
+// output is the same.
+template <typename To, typename From>
+result convert_pipelined(const char *input, const char *output,
+                         const options &options = {},
+                         const pipeline_options &pipeline = {}) {
+  static_assert(std::is_floating_point_v<From> && std::is_integral_v<To>);
+  const auto start = std::chrono::steady_clock::now();
+  result total;
+  {
+    const detail::descriptor in_file{input, O_RDONLY};
+    const std::size_t n{detail::value_count<From>(input, in_file.size(), 0)};
+    const detail::descriptor out_file{output, O_WRONLY | O_CREAT, 0644};
+    detail::truncate_output(in_file, out_file, output);
+    detail::convert_pipelined<To, From>(in_file, 0, out_file, 0, n, options,
+                                        pipeline, total);
+  }
+  total.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return total;
+}
+
+} // namespace clamp_cast::file
+
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef CLAMP_CAST_PROFILE_HPP
+#define CLAMP_CAST_PROFILE_HPP
+
+// Samples the inputs of clamp_cast_n to show how they are distributed relative
+// to the bounds of the destination type: how many are NaN, how many are out of
+// range and how close the others are to the bounds. This helps to pick the
+// engine that suits the data. Enable it by defining CLAMP_CAST_PROFILE for the
+// whole program, which makes clamp-cast-bulk.hpp include this header.
+//
+// Every (To, From) pair has a log scale histogram of the ratio between the
+// magnitude of a value and the bound on its side: upper_bound_exclusive for
+// positive values and the magnitude of lower_bound_inclusive for negative
+// ones. Bucket e counts values with 2**e <= ratio < 2**(e + 1) so buckets
+// below 0 are in range, bucket -1 is close to the bounds and buckets from 0 on
+// are at or past them. For unsigned To every negative value is out of range and
+// the negative side is relative to 1.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "clamp-cast-bulk.hpp"
+
+#ifndef CLAMP_CAST_PROFILE
+#error "define CLAMP_CAST_PROFILE to enable profiling"
+#endif
+
+namespace clamp_cast::profile {
+
+// The buckets of a histogram cover e in [min_exponent, max_exponent]. Values
+// outside are counted in the first or last bucket.
+constexpr int min_exponent{-96};
+constexpr int max_exponent{31};
+constexpr std::size_t buckets{max_exponent - min_exponent + 1};
+
+// The profile of one (To, From) pair.
+struct pair_profile {
+  std::string to;
+  std::string from;
+  std::uint64_t samples;
+  std::uint64_t nan;
+  std::uint64_t zero;
+  // Indexed by e - min_exponent.
+  std::array<std::uint64_t, buckets> negative;
+  std::array<std::uint64_t, buckets> positive;
+};
+
+namespace detail {
+
+inline std::atomic<std::size_t> &sampling_interval_storage() {
+  static std::atomic<std::size_t> interval{64};
+  return interval;
+}
+
+struct histogram {
+  const char *to;
+  const char *from;
+  std::atomic<std::uint64_t> samples{0};
+  std::atomic<std::uint64_t> nan{0};
+  std::atomic<std::uint64_t> zero{0};
+  std::array<std::atomic<std::uint64_t>, buckets> negative{};
+  std::array<std::atomic<std::uint64_t>, buckets> positive{};
+};
+
+class registry {
+public:
+  void add(histogram &histogram) {
+    const std::lock_guard<std::mutex> lock{mutex_};
+    histograms_.push_back(&histogram);
+  }
+
+  std::vector<pair_profile> snapshot() const {
+    const std::lock_guard<std::mutex> lock{mutex_};
+    std::vector<pair_profile> result;
+    for (const auto *h : histograms_) {
+      pair_profile profile{h->to, h->from, h->samples.load(), h->nan.load(),
+                           h->zero.load(), {}, {}};
+      for (std::size_t i{0}; i < buckets; ++i) {
+        profile.negative[i] = h->negative[i].load();
+        profile.positive[i] = h->positive[i].load();
+      }
+      result.push_back(profile);
+    }
+    return result;
+  }
+
+  void reset() {
+    const std::lock_guard<std::mutex> lock{mutex_};
+    for (auto *h : histograms_) {
+      h->samples = 0;
+      h->nan = 0;
+      h->zero = 0;
+      for (std::size_t i{0}; i < buckets; ++i) {
+        h->negative[i] = 0;
+        h->positive[i] = 0;
+      }
+    }
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<histogram *> histograms_;
+};
+
+// Never freed like the histograms so that the handler of write_json_at_exit
+// can read it even if the registry was built after the handler was registered.
+inline registry &global_registry() {
+  static registry *const instance{new registry};
+  return *instance;
+}
+
+// The histogram of a pair. It is registered on first use.
+template <typename To, typename From> histogram &histogram_of() {
+  static histogram *instance{[] {
+    auto *h = new histogram;
+    h->to = clamp_cast::detail::type_name<To>();
+    h->from = clamp_cast::detail::type_name<From>();
+    global_registry().add(*h);
+    return h;
+  }()};
+  return *instance;
+}
+
+} // namespace detail
+
+// Samples every interval-th element passed to clamp_cast_n. The default is 64.
+inline void set_sampling_interval(const std::size_t interval) noexcept {
+  detail::sampling_interval_storage().store(std::max<std::size_t>(interval, 1),
+                                            std::memory_order_relaxed);
+}
+
+template <typename To, typename From>
+void sample(const From *in, const std::size_t n) noexcept {
+  // The position of the next sample carries over between calls so that short
+  // calls are sampled too.
+  thread_local std::size_t next{0};
+  const auto interval =
+      detail::sampling_interval_storage().load(std::memory_order_relaxed);
+  // The interval might have been lowered since the last call.
+  next = std::min(next, interval - 1);
+  if (next >= n) {
+    next -= n;
+    return;
+  }
+  detail::histogram *h;
+  try {
+    h = &detail::histogram_of<To, From>();
+  } catch (...) {
+    return;
+  }
+  // The bounds are powers of 2 so the ratio's exponent is a difference of
+  // exponents.
+  constexpr int bound_exponent{std::numeric_limits<To>::digits};
+  constexpr int negative_bound_exponent{
+      std::numeric_limits<To>::is_signed ? bound_exponent : 0};
+  std::size_t i{next};
+  for (; i < n; i += interval) {
+    const From from{in[i]};
+    h->samples.fetch_add(1, std::memory_order_relaxed);
+    if (is_nan(from)) {
+      h->nan.fetch_add(1, std::memory_order_relaxed);
+    } else if (from == 0) {
+      h->zero.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      const bool negative{from < 0};
+      const int e{std::isinf(from)
+                      ? max_exponent
+                      : std::clamp(std::ilogb(from) -
+                                       (negative ? negative_bound_exponent
+                                                 : bound_exponent),
+                                   min_exponent, max_exponent)};
+      auto &bucket = (negative ? h->negative : h->positive)[static_cast<
+          std::size_t>(e - min_exponent)];
+      bucket.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  next = i - n;
+}
+
+// The profiles of all pairs so far.
+inline std::vector<pair_profile> snapshot() {
+  return detail::global_registry().snapshot();
+}
+
+inline void reset() { detail::global_registry().reset(); }
+
+// Writes the profiles as JSON in the form
+// {"pairs": [{"to": "int16", "from": "float", "samples": 10, "nan": 1,
+// "zero": 2, "negative": {"-3": 4}, "positive": {"0": 3}}]}
+// where the histograms map e to the count and leave out empty buckets.
+inline void write_json(std::ostream &stream) {
+  const auto write_histogram =
+      [&](const std::array<std::uint64_t, buckets> &histogram) {
+        stream << "{";
+        const char *separator{""};
+        for (std::size_t i{0}; i < buckets; ++i) {
+          if (histogram[i] != 0) {
+            stream << separator << "\"" << static_cast<int>(i) + min_exponent
+                   << "\": " << histogram[i];
+            separator = ", ";
+          }
+        }
+        stream << "}";
+      };
+  stream << "{\"pairs\": [";
+  const char *separator{""};
+  for (const auto &pair : snapshot()) {
+    stream << separator << "\n  {\"to\": \"" << pair.to << "\", \"from\": \""
+           << pair.from << "\", \"samples\": " << pair.samples
+           << ", \"nan\": " << pair.nan << ", \"zero\": " << pair.zero
+           << ", \"negative\": ";
+    write_histogram(pair.negative);
+    stream << ", \"positive\": ";
+    write_histogram(pair.positive);
+    stream << "}";
+    separator = ",";
+  }
+  stream << "\n]}\n";
+}
+
+// Writes the profiles as JSON to the file at path when the program exits.
+inline void write_json_at_exit(std::string path) {
+  static std::string output;
+  output = std::move(path);
+  std::atexit([] {
+    std::ofstream stream{output};
+    write_json(stream);
+  });
+}
+
+} // namespace clamp_cast::profile
+
+#endif
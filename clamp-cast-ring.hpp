@@ -0,0 +1,127 @@
+#ifndef CLAMP_CAST_RING_HPP
+#define CLAMP_CAST_RING_HPP
+
+// A single producer single consumer ring buffer that converts on enqueue. The
+// producer converts its values with the bulk kernels straight into the storage
+// of the ring and the consumer reads the converted values in place, so the
+// values are copied once. Both sides are wait-free: they never lock, allocate
+// or wait for the other side and return how much they could do instead.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast-stream.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast {
+
+template <typename To, typename From, typename Policy = policy<>>
+class conversion_ring {
+public:
+  // The capacity is rounded up to a power of 2. The storage is allocated here
+  // and nowhere else.
+  explicit conversion_ring(const std::size_t capacity,
+                           const Policy &policy = {})
+      : capacity_{round_up(capacity)},
+        storage_{std::make_unique<To[]>(capacity_)}, policy_{policy} {}
+
+  conversion_ring(const conversion_ring &) = delete;
+  conversion_ring &operator=(const conversion_ring &) = delete;
+
+  std::size_t capacity() const noexcept { return capacity_; }
+
+  // Producer: converts up to n values into the ring and returns how many. Less
+  // than n if the ring is full.
+  std::size_t push(const From *in,
+                   const std::size_t n CLAMP_CAST_CALL_SITE) noexcept(
+      detail::is_nothrow_policy<To, Policy>) {
+    const std::size_t head{producer_.position.load(std::memory_order_relaxed)};
+    if (capacity_ - (head - producer_.other) < n) {
+      producer_.other = consumer_.position.load(std::memory_order_acquire);
+    }
+    const std::size_t free{capacity_ - (head - producer_.other)};
+    const std::size_t count{n < free ? n : free};
+    const std::size_t offset{head & (capacity_ - 1)};
+    const std::size_t first{count < capacity_ - offset ? count
+                                                       : capacity_ - offset};
+    CLAMP_CAST_RECORD_N(To, in, count);
+    CLAMP_CAST_PROFILE_N(To, in, count);
+    detail::clamp_cast_n_engine<engine::automatic>(in, first,
+                                                   storage_.get() + offset,
+                                                   policy_);
+    detail::clamp_cast_n_engine<engine::automatic>(
+        in + first, count - first, storage_.get(), policy_);
+    producer_.position.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer: the converted values that can be read in place. They are
+  // contiguous so this can be fewer than have been pushed when they wrap
+  // around the end of the storage.
+  span<const To> front() noexcept {
+    const std::size_t tail{consumer_.position.load(std::memory_order_relaxed)};
+    if (consumer_.other == tail) {
+      consumer_.other = producer_.position.load(std::memory_order_acquire);
+    }
+    const std::size_t offset{tail & (capacity_ - 1)};
+    const std::size_t available{consumer_.other - tail};
+    return {storage_.get() + offset, available < capacity_ - offset
+                                         ? available
+                                         : capacity_ - offset};
+  }
+
+  // Consumer: releases the first n values of front to the producer.
+  void pop(const std::size_t n) noexcept {
+    consumer_.position.store(
+        consumer_.position.load(std::memory_order_relaxed) + n,
+        std::memory_order_release);
+  }
+
+  // Consumer: copies up to n values to out and returns how many.
+  std::size_t pop(To *out, const std::size_t n) noexcept {
+    std::size_t copied{0};
+    while (copied < n) {
+      const auto values = front();
+      if (values.empty()) {
+        break;
+      }
+      const std::size_t count{values.size() < n - copied ? values.size()
+                                                         : n - copied};
+      for (std::size_t i{0}; i < count; ++i) {
+        out[copied + i] = values[i];
+      }
+      pop(count);
+      copied += count;
+    }
+    return copied;
+  }
+
+private:
+  static std::size_t round_up(const std::size_t capacity) noexcept {
+    std::size_t power{1};
+    while (power < capacity) {
+      power *= 2;
+    }
+    return power;
+  }
+
+  // The position of one side, which only that side writes, and its last
+  // known position of the other side, which saves loading the other cache
+  // line on every call. Both sides are on their own cache lines.
+  struct alignas(64) side {
+    std::atomic<std::size_t> position{0};
+    std::size_t other{0};
+  };
+
+  const std::size_t capacity_;
+  const std::unique_ptr<To[]> storage_;
+  Policy policy_;
+  side producer_;
+  side consumer_;
+};
+
+} // namespace clamp_cast
+
+#endif
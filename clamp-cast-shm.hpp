@@ -0,0 +1,398 @@
+#ifndef CLAMP_CAST_SHM_HPP
+#define CLAMP_CAST_SHM_HPP
+
+// Passes converted frames between processes through shared memory on Linux.
+// The producer converts its values with the bulk kernels directly into a slot
+// of the shared segment and the consumer reads the converted values in place,
+// so neither side copies them. The sides wait for each other on two sequence
+// counters in the segment with futexes, which costs no system call while
+// neither side is waiting.
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast-stream.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast {
+
+namespace detail {
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free &&
+                  sizeof(std::atomic<std::uint32_t>) == 4,
+              "futexes need lock-free 32 bit atomics");
+
+// A counter that only one process increments, and the number of processes
+// that wait for it to change so that the increment only wakes them if there
+// are any.
+struct shared_counter {
+  std::atomic<std::uint32_t> value{0};
+  std::atomic<std::uint32_t> waiters{0};
+};
+
+// The start of the segment. The sizes and kinds of the types and the layout
+// are checked by the processes that map an existing segment.
+struct shared_header {
+  std::uint64_t magic;
+  std::uint32_t from_type;
+  std::uint32_t to_type;
+  std::uint64_t capacity;
+  std::uint32_t slots;
+  // The number of frames that have been published and consumed. The slot of
+  // a frame is its number modulo slots.
+  alignas(64) shared_counter published;
+  alignas(64) shared_counter consumed;
+};
+
+constexpr std::uint64_t shared_magic{0x74736163706d616cu};
+
+template <typename T>
+constexpr std::uint32_t type_tag{
+    static_cast<std::uint32_t>(sizeof(T)) |
+    (std::numeric_limits<T>::is_integer ? 0x100u : 0u) |
+    (std::numeric_limits<T>::is_signed ? 0x200u : 0u)};
+
+[[noreturn]] inline void throw_errno(const char *what) {
+  throw std::system_error{errno, std::generic_category(), what};
+}
+
+// Waits until counter is no longer expected or until the deadline if there is
+// one. Returns whether the counter changed.
+inline bool wait_while_equal(
+    shared_counter &counter, const std::uint32_t expected,
+    const std::chrono::steady_clock::time_point *deadline) noexcept {
+  while (counter.value.load(std::memory_order_acquire) == expected) {
+    timespec timeout{};
+    if (deadline != nullptr) {
+      const auto remaining = *deadline - std::chrono::steady_clock::now();
+      if (remaining <= remaining.zero()) {
+        return false;
+      }
+      const auto seconds =
+          std::chrono::duration_cast<std::chrono::seconds>(remaining);
+      timeout.tv_sec = static_cast<std::time_t>(seconds.count());
+      timeout.tv_nsec = static_cast<long>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining -
+                                                               seconds)
+              .count());
+    }
+    // The increment of waiters and the load of the value are ordered against
+    // the increment of the value and the load of waiters in advance so that
+    // one of the sides sees the other. FUTEX_WAIT returns at once if the value
+    // changed in between.
+    counter.waiters.fetch_add(1, std::memory_order_seq_cst);
+    if (counter.value.load(std::memory_order_seq_cst) == expected) {
+      syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&counter.value),
+              FUTEX_WAIT, expected, deadline != nullptr ? &timeout : nullptr,
+              nullptr, 0);
+    }
+    counter.waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+inline void advance(shared_counter &counter) noexcept {
+  counter.value.fetch_add(1, std::memory_order_seq_cst);
+  if (counter.waiters.load(std::memory_order_seq_cst) != 0) {
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&counter.value),
+            FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+}
+
+} // namespace detail
+
+// A channel of frames of up to capacity values between one producer and one
+// consumer process. The segment has a staging area of capacity values of
+// From, written only by the producer, and slots frames of capacity values of
+// To. The producer either converts from its own memory with publish(in, n) or
+// writes the values into staging() and converts them with publish(n), for
+// example when a device or a reader fills the shared memory. The bulk kernels
+// need the input and output not to overlap, which is why the staging area is
+// separate from the slots. The consumer reads the oldest frame in place with
+// front() and releases its slot with pop().
+//
+// The number of slots must be a power of 2. Frame f uses slot f % slots of the
+// 32 bit frame counters, which stays consecutive when they wrap around only
+// if slots divides 2**32. Other numbers throw std::invalid_argument.
+//
+// create makes a new segment: an anonymous memfd that other processes get by
+// fork or over a unix socket and open with open(fd), or a POSIX shared memory
+// object that they open by name. The name is removed with shm_unlink. Errors
+// of the system calls throw std::system_error and segments of other types or
+// layouts throw std::invalid_argument. The capacity and the slots are checked
+// once and kept by each process, so a process that writes to the segment can
+// not make the other one read or write outside of it.
+template <typename To, typename From, typename Policy = policy<>,
+          engine Engine = engine::automatic>
+class shared_channel {
+public:
+  static shared_channel create(const std::size_t capacity,
+                               const std::uint32_t slots = 2,
+                               const Policy &policy = {}) {
+    check_slots(slots);
+    const int fd{::memfd_create("clamp-cast", MFD_CLOEXEC)};
+    if (fd < 0) {
+      detail::throw_errno("memfd_create");
+    }
+    return initialize(fd, capacity, slots, policy);
+  }
+
+  static shared_channel create(const char *name, const std::size_t capacity,
+                               const std::uint32_t slots = 2,
+                               const Policy &policy = {}) {
+    check_slots(slots);
+    const int fd{::shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600)};
+    if (fd < 0) {
+      detail::throw_errno("shm_open");
+    }
+    return initialize(fd, capacity, slots, policy);
+  }
+
+  // Maps the segment of a file descriptor, which stays open.
+  static shared_channel open(const int fd, const Policy &policy = {}) {
+    const int own{::fcntl(fd, F_DUPFD_CLOEXEC, 0)};
+    if (own < 0) {
+      detail::throw_errno("fcntl");
+    }
+    return attach(own, policy);
+  }
+
+  static shared_channel open(const char *name, const Policy &policy = {}) {
+    const int fd{::shm_open(name, O_RDWR | O_CLOEXEC, 0)};
+    if (fd < 0) {
+      detail::throw_errno("shm_open");
+    }
+    return attach(fd, policy);
+  }
+
+  shared_channel(shared_channel &&other) noexcept
+      : fd_{other.fd_}, memory_{other.memory_}, size_{other.size_},
+        capacity_{other.capacity_}, slots_{other.slots_},
+        policy_{other.policy_} {
+    other.fd_ = -1;
+    other.memory_ = nullptr;
+  }
+
+  shared_channel(const shared_channel &) = delete;
+  shared_channel &operator=(const shared_channel &) = delete;
+
+  ~shared_channel() {
+    if (memory_ != nullptr) {
+      ::munmap(memory_, size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  // The file descriptor of the segment to pass to other processes.
+  int fd() const noexcept { return fd_; }
+  std::size_t capacity() const noexcept { return capacity_; }
+  std::uint32_t slots() const noexcept { return slots_; }
+
+  // Producer: the shared values that publish(n) converts.
+  span<From> staging() noexcept {
+    return {reinterpret_cast<From *>(bytes() + staging_offset), capacity()};
+  }
+
+  // Producer: converts the first n values of staging() into the next frame.
+  // Waits while every slot holds a frame that has not been consumed. Throws
+  // std::invalid_argument if n is larger than capacity().
+  void publish(const std::size_t n CLAMP_CAST_CALL_SITE) {
+    publish(staging().data(), n CLAMP_CAST_FORWARD_CALL_SITE);
+  }
+
+  // Producer: converts n values of in into the next frame. Throws
+  // std::invalid_argument if n is larger than capacity().
+  void publish(const From *in, const std::size_t n CLAMP_CAST_CALL_SITE) {
+    if (n > capacity_) {
+      throw std::invalid_argument{"a frame larger than the shared_channel"};
+    }
+    CLAMP_CAST_RECORD_N(To, in, n);
+    CLAMP_CAST_PROFILE_N(To, in, n);
+    auto &h = header();
+    const std::uint32_t frame{
+        h.published.value.load(std::memory_order_relaxed)};
+    detail::wait_while_equal(h.consumed, frame - slots_, nullptr);
+    std::byte *const slot{slot_bytes(frame)};
+    detail::clamp_cast_n_engine<Engine>(in, n, values(slot), policy_);
+    *reinterpret_cast<std::uint64_t *>(slot) = n;
+    detail::advance(h.published);
+  }
+
+  // Consumer: waits for a frame for at most timeout and returns whether there
+  // is one.
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    const std::chrono::steady_clock::time_point deadline{
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            timeout)};
+    auto &h = header();
+    return detail::wait_while_equal(
+        h.published, h.consumed.value.load(std::memory_order_relaxed),
+        &deadline);
+  }
+
+  // Consumer: waits for the oldest frame that has not been consumed and
+  // returns its values, which stay valid until pop. A corrupted length is
+  // clamped to capacity().
+  span<const To> front() noexcept {
+    auto &h = header();
+    const std::uint32_t frame{h.consumed.value.load(std::memory_order_relaxed)};
+    detail::wait_while_equal(h.published, frame, nullptr);
+    const std::byte *const slot{slot_bytes(frame)};
+    const std::uint64_t n{*reinterpret_cast<const std::uint64_t *>(slot)};
+    return {values(slot),
+            n < capacity_ ? static_cast<std::size_t>(n) : capacity_};
+  }
+
+  // Consumer: releases the slot of the frame that front returned.
+  void pop() noexcept { detail::advance(header().consumed); }
+
+private:
+  static constexpr std::size_t round_up(const std::size_t size) noexcept {
+    return (size + 63) / 64 * 64;
+  }
+
+  // The segment is the header, the staging area and the slots, each at a
+  // multiple of 64 bytes. A slot is the number of values of its frame in the
+  // first 64 bytes and the values.
+  static constexpr std::size_t staging_offset{
+      round_up(sizeof(detail::shared_header))};
+
+  static std::size_t slots_offset(const std::size_t capacity) noexcept {
+    return staging_offset + round_up(capacity * sizeof(From));
+  }
+
+  static std::size_t slot_size(const std::size_t capacity) noexcept {
+    return 64 + round_up(capacity * sizeof(To));
+  }
+
+  static std::size_t segment_size(const std::size_t capacity,
+                                   const std::uint32_t slots) noexcept {
+    return slots_offset(capacity) + slots * slot_size(capacity);
+  }
+
+  shared_channel(const int fd, const Policy &policy) noexcept
+      : fd_{fd}, policy_{policy} {}
+
+  static constexpr bool valid_slots(const std::uint32_t slots) noexcept {
+    return slots != 0 && (slots & (slots - 1)) == 0;
+  }
+
+  static void check_slots(const std::uint32_t slots) {
+    if (!valid_slots(slots)) {
+      throw std::invalid_argument{
+          "a shared_channel needs a power of 2 of slots"};
+    }
+  }
+
+  static shared_channel initialize(const int fd, const std::size_t capacity,
+                                   const std::uint32_t slots,
+                                   const Policy &policy) {
+    shared_channel channel{fd, policy};
+    const std::size_t size{segment_size(capacity, slots)};
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      detail::throw_errno("ftruncate");
+    }
+    channel.map(size);
+    auto *const h = new (channel.memory_) detail::shared_header{};
+    h->from_type = detail::type_tag<From>;
+    h->to_type = detail::type_tag<To>;
+    h->capacity = capacity;
+    h->slots = slots;
+    h->magic = detail::shared_magic;
+    channel.capacity_ = capacity;
+    channel.slots_ = slots;
+    return channel;
+  }
+
+  static shared_channel attach(const int fd, const Policy &policy) {
+    shared_channel channel{fd, policy};
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+      detail::throw_errno("fstat");
+    }
+    const auto size = static_cast<std::size_t>(status.st_size);
+    if (size < sizeof(detail::shared_header)) {
+      throw std::invalid_argument{"not a shared_channel"};
+    }
+    channel.map(size);
+    const auto &h = channel.header();
+    if (h.magic != detail::shared_magic ||
+        h.from_type != detail::type_tag<From> ||
+        h.to_type != detail::type_tag<To> || !valid_slots(h.slots) ||
+        h.capacity > size || h.slots > size ||
+        segment_size(static_cast<std::size_t>(h.capacity), h.slots) != size) {
+      throw std::invalid_argument{"not a shared_channel of these types"};
+    }
+    channel.capacity_ = static_cast<std::size_t>(h.capacity);
+    channel.slots_ = h.slots;
+    return channel;
+  }
+
+  void map(const std::size_t size) {
+    void *const memory{
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0)};
+    if (memory == MAP_FAILED) {
+      detail::throw_errno("mmap");
+    }
+    memory_ = memory;
+    size_ = size;
+  }
+
+  std::byte *bytes() const noexcept {
+    return static_cast<std::byte *>(memory_);
+  }
+
+  detail::shared_header &header() const noexcept {
+    return *std::launder(reinterpret_cast<detail::shared_header *>(memory_));
+  }
+
+  std::byte *slot_bytes(const std::uint32_t frame) const noexcept {
+    return bytes() + slots_offset(capacity_) +
+           frame % slots_ * slot_size(capacity_);
+  }
+
+  static To *values(std::byte *slot) noexcept {
+    return reinterpret_cast<To *>(slot + 64);
+  }
+
+  static const To *values(const std::byte *slot) noexcept {
+    return reinterpret_cast<const To *>(slot + 64);
+  }
+
+  int fd_;
+  void *memory_{nullptr};
+  std::size_t size_{0};
+  std::size_t capacity_{0};
+  std::uint32_t slots_{0};
+  Policy policy_;
+};
+
+} // namespace clamp_cast
+
+#endif
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef CLAMP_CAST_STREAM_HPP
+#define CLAMP_CAST_STREAM_HPP
+
+// Converts a stream that arrives in chunks of arbitrary size, for example audio
+// or telemetry, with the bulk kernels. The output is the same as converting the
+// whole stream at once with clamp_cast_n.
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast.hpp"
+
+namespace clamp_cast {
+
+// A view of count contiguous elements like std::span, which is not available in
+// c++17.
+template <typename T> class span {
+public:
+  constexpr span() noexcept = default;
+  constexpr span(T *data, const std::size_t size) noexcept
+      : data_{data}, size_{size} {}
+  // Views a contiguous container such as std::vector, std::array or an array
+  // whose elements convert to T. It is implicit like the one of std::span so
+  // that a container can be passed where a span is expected, for example to
+  // stream_converter::push.
+  template <typename Container,
+            typename = std::enable_if_t<
+                std::is_convertible_v<
+                    decltype(std::data(std::declval<Container &>())), T *> &&
+                std::is_convertible_v<
+                    decltype(std::size(std::declval<Container &>())),
+                    std::size_t>>>
+  constexpr span(Container &container) noexcept
+      : data_{std::data(container)}, size_{std::size(container)} {}
+
+  constexpr T *data() const noexcept { return data_; }
+  constexpr std::size_t size() const noexcept { return size_; }
+  constexpr bool empty() const noexcept { return size_ == 0; }
+  constexpr T *begin() const noexcept { return data_; }
+  constexpr T *end() const noexcept { return data_ + size_; }
+  constexpr T &operator[](const std::size_t i) const noexcept {
+    return data_[i];
+  }
+
+private:
+  T *data_{nullptr};
+  std::size_t size_{0};
+};
+
+// Converts chunks of a stream and returns the converted elements in a buffer
+// that it owns. The kernels convert whole vectors of values so that short
+// chunks are not converted element by element at the end of every chunk.
+// Instead up to alignment - 1 values are kept until the next push fills the
+// vector, so a push can return fewer elements than it was given. flush
+// converts the values that are kept at the end of the stream.
+//
+// The buffer grows to the largest chunk and is reused so that a stream of
+// chunks of bounded size allocates nothing after the first ones. The returned
+// span is valid until the next call. If the policy throws then the stream has
+// to be started again with flush.
+template <typename To, typename From, typename Policy = policy<>,
+          engine Engine = engine::automatic>
+class stream_converter {
+public:
+  // The number of values that the SIMD kernel converts at once.
+  static constexpr std::size_t alignment{
+#ifdef CLAMP_CAST_SSE2
+      has_simd_kernel<To, From>() ? detail::vector_elements<To> : 1
+#else
+      1
+#endif
+  };
+
+  stream_converter() = default;
+  explicit stream_converter(const Policy &policy) : policy_{policy} {}
+
+  span<To> push(const span<const From> chunk CLAMP_CAST_CALL_SITE) {
+    // Room for a chunk of this size with any number of kept values so that
+    // the buffer only grows with the size of the chunks.
+    if (buffer_.size() < chunk.size() + alignment - 1) {
+      buffer_.resize(chunk.size() + alignment - 1);
+    }
+    return push(chunk, buffer_.data() CLAMP_CAST_FORWARD_CALL_SITE);
+  }
+
+  span<To> push(const From *in, const std::size_t n CLAMP_CAST_CALL_SITE) {
+    return push(span<const From>{in, n} CLAMP_CAST_FORWARD_CALL_SITE);
+  }
+
+  // Like push but stores the converted elements in out instead of the buffer,
+  // which saves a copy. out must have room for chunk.size() + alignment - 1
+  // elements.
+  span<To> push(const span<const From> chunk,
+                To *const out CLAMP_CAST_CALL_SITE) noexcept(
+      detail::is_nothrow_policy<To, Policy>) {
+    const From *in{chunk.data()};
+    std::size_t n{chunk.size()};
+    CLAMP_CAST_RECORD_N(To, in, n);
+    CLAMP_CAST_PROFILE_N(To, in, n);
+    const std::size_t total{kept_ + n};
+    if (total < alignment) {
+      append(in, n);
+      return {out, 0};
+    }
+    To *next{out};
+    if (kept_ != 0) {
+      // Completes the vector of the values that were kept.
+      const std::size_t missing{alignment - kept_};
+      append(in, missing);
+      convert(kept_values_, alignment, next);
+      in += missing;
+      n -= missing;
+      next += alignment;
+      kept_ = 0;
+    }
+    const std::size_t whole{n - n % alignment};
+    convert(in, whole, next);
+    append(in + whole, n - whole);
+    return {out, total - total % alignment};
+  }
+
+  // Converts the values that are kept and starts a new stream.
+  span<To> flush() {
+    if (buffer_.size() < kept_) {
+      buffer_.resize(kept_);
+    }
+    convert(kept_values_, kept_, buffer_.data());
+    const span<To> converted{buffer_.data(), kept_};
+    kept_ = 0;
+    return converted;
+  }
+
+  // The number of values that are kept until the next push or flush.
+  std::size_t pending() const noexcept { return kept_; }
+
+private:
+  void append(const From *in, const std::size_t n) noexcept {
+    // Nothing is kept without a SIMD kernel.
+    if constexpr (alignment > 1) {
+      for (std::size_t i{0}; i < n; ++i) {
+        kept_values_[kept_ + i] = in[i];
+      }
+      kept_ += n;
+    }
+  }
+
+  void convert(const From *in, const std::size_t n, To *out) noexcept(
+      detail::is_nothrow_policy<To, Policy>) {
+    detail::clamp_cast_n_engine<Engine>(in, n, out, policy_);
+  }
+
+  Policy policy_{};
+  std::vector<To> buffer_;
+  From kept_values_[alignment]{};
+  std::size_t kept_{0};
+};
+
+} // namespace clamp_cast
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef CLAMP_CAST_TELEMETRY_HPP
+#define CLAMP_CAST_TELEMETRY_HPP
+
+// Counts the results of clamp_cast and clamp_cast_n per call site to find the
+// places where values are clamped in production. Enable it by defining
+// CLAMP_CAST_TELEMETRY for the whole program, which makes clamp-cast.hpp
+// include this header.
+//
+// Every thread counts in its own relaxed atomics so that counting does not
+// contend and other threads can still read the counters for a dump.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "clamp-cast.hpp"
+
+#ifndef CLAMP_CAST_TELEMETRY
+#error "define CLAMP_CAST_TELEMETRY to enable telemetry"
+#endif
+
+namespace clamp_cast::telemetry {
+
+// The number of values of each conversion_status.
+using status_counts = std::array<std::uint64_t, 5>;
+
+// The counts of one call site.
+struct site_counts {
+  std::string file;
+  std::string function;
+  unsigned line;
+  status_counts counts;
+};
+
+namespace detail {
+
+// The counters of one call site in one thread. Only that thread writes them.
+struct thread_site {
+  call_site site;
+  std::array<std::atomic<std::uint64_t>, 5> counters{};
+
+  void add(const std::size_t status, const std::uint64_t count) noexcept {
+    // There is only one writer so a load and a store are enough and cheaper
+    // than a read-modify-write.
+    auto &counter = counters[status];
+    counter.store(counter.load(std::memory_order_relaxed) + count,
+                  std::memory_order_relaxed);
+  }
+};
+
+// Owns the counters of all threads.
+class registry {
+public:
+  thread_site &add(const call_site &site) {
+    const std::lock_guard<std::mutex> lock{mutex_};
+    sites_.push_back(std::make_unique<thread_site>());
+    sites_.back()->site = site;
+    return *sites_.back();
+  }
+
+  std::vector<site_counts> snapshot() const {
+    const std::lock_guard<std::mutex> lock{mutex_};
+    std::vector<site_counts> result;
+    for (const auto &site : sites_) {
+      // Sites of different threads and translation units are merged.
+      auto merged = std::find_if(result.begin(), result.end(), [&](auto &r) {
+        return r.line == site->site.line &&
+               r.file == site->site.file &&
+               r.function == site->site.function;
+      });
+      if (merged == result.end()) {
+        result.push_back({site->site.file, site->site.function,
+                          site->site.line, status_counts{}});
+        merged = result.end() - 1;
+      }
+      for (std::size_t i{0}; i < merged->counts.size(); ++i) {
+        merged->counts[i] += site->counters[i].load(std::memory_order_relaxed);
+      }
+    }
+    std::sort(result.begin(), result.end(), [](auto &a, auto &b) {
+      return std::tie(a.file, a.line, a.function) <
+             std::tie(b.file, b.line, b.function);
+    });
+    return result;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<thread_site>> sites_;
+};
+
+// The registry and with it the counters are never freed so that they outlive
+// their threads and the handler of dump_at_exit, which std::atexit would
+// otherwise run after a registry built by a later conversion is destroyed.
+inline registry &global_registry() {
+  static registry *const instance{new registry};
+  return *instance;
+}
+
+struct site_hash {
+  std::size_t operator()(const call_site &site) const noexcept {
+    return std::hash<const void *>{}(site.file) ^
+           std::hash<const void *>{}(site.function) ^ site.line;
+  }
+};
+
+struct site_equal {
+  bool operator()(const call_site &a, const call_site &b) const noexcept {
+    return a.file == b.file && a.function == b.function && a.line == b.line;
+  }
+};
+
+// The counters of the calling thread for the site. Looking them up does not
+// lock except for the first call from a site in each thread.
+inline thread_site &counters_of(const call_site &site) {
+  thread_local std::unordered_map<call_site, thread_site *, site_hash,
+                                  site_equal>
+      sites;
+  // Loops usually call the same site repeatedly.
+  thread_local thread_site *last{nullptr};
+  if (last != nullptr && site_equal{}(last->site, site)) {
+    return *last;
+  }
+  auto &entry = sites[site];
+  if (entry == nullptr) {
+    entry = &global_registry().add(site);
+  }
+  last = entry;
+  return *entry;
+}
+
+} // namespace detail
+
+template <typename To, typename From>
+void record(const From from, const call_site &site) noexcept {
+  // Calls from inside of the library pass an empty site.
+  if (site.file == nullptr) {
+    return;
+  }
+  const auto status = checked_clamp_cast<To>(from).status;
+  try {
+    detail::counters_of(site).add(static_cast<std::size_t>(status), 1);
+  } catch (...) {
+    // Telemetry must not make conversions fail. Without memory the value is
+    // not counted.
+  }
+}
+
+template <typename To, typename From>
+void record_n(const From *in, const std::size_t n,
+              const call_site &site) noexcept {
+  if (site.file == nullptr) {
+    return;
+  }
+  status_counts local{};
+  for (std::size_t i{0}; i < n; ++i) {
+    ++local[static_cast<std::size_t>(checked_clamp_cast<To>(in[i]).status)];
+  }
+  try {
+    auto &counters = detail::counters_of(site);
+    for (std::size_t status{0}; status < local.size(); ++status) {
+      counters.add(status, local[status]);
+    }
+  } catch (...) {
+  }
+}
+
+// The counts of all call sites so far.
+inline std::vector<site_counts> snapshot() {
+  return detail::global_registry().snapshot();
+}
+
+// Writes one line per call site in the form
+// `file:line: function: exact=1 truncated=2 saturated_low=3 ...`.
+inline void dump(std::ostream &stream) {
+  static constexpr const char *names[]{"exact", "truncated", "saturated_low",
+                                       "saturated_high", "nan"};
+  for (const auto &site : snapshot()) {
+    stream << site.file << ":" << site.line << ": " << site.function << ":";
+    for (std::size_t i{0}; i < site.counts.size(); ++i) {
+      stream << " " << names[i] << "=" << site.counts[i];
+    }
+    stream << "\n";
+  }
+}
+
+// Dumps the counts to stderr when the program exits.
+inline void dump_at_exit() {
+  std::atexit([] { dump(std::cerr); });
+}
+
+} // namespace clamp_cast::telemetry
+
+#endif
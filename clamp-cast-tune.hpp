@@ -0,0 +1,386 @@
+#ifndef CLAMP_CAST_TUNE_HPP
+#define CLAMP_CAST_TUNE_HPP
+
+// Selects the fastest engine of clamp_cast_n for every (To, From) pair and
+// size class by measuring the engines on the running machine. A pair is
+// calibrated when it is first converted with tune::clamp_cast_n or when
+// calibrate is called, which takes a few milliseconds. By default the engines
+// are measured on mostly in range values with a few NaN and out of range ones
+// mixed in. Programs whose values look different can calibrate on a sample of
+// their own input instead.
+//
+// The choices can be kept in a cache file so that later processes do not
+// calibrate again. The file is set with set_cache_file or with the environment
+// variable CLAMP_CAST_TUNE_CACHE. It is read on first use and rewritten after
+// every calibration. The file describes one machine and should not be shared
+// between different ones.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clamp-cast-bulk.hpp"
+
+namespace clamp_cast::tune {
+
+// Calls with fewer than 256 elements are small, calls with fewer than 16384
+// medium and the others large.
+constexpr std::size_t size_classes{3};
+
+constexpr std::size_t size_class(const std::size_t n) noexcept {
+  return n < 256 ? 0 : n < 16384 ? 1 : 2;
+}
+
+// The engine for every size class.
+using choice = std::array<engine, size_classes>;
+
+namespace detail {
+
+// The engines that are measured. automatic is not one of them because it is
+// the same as one of the others.
+constexpr engine candidates[]{engine::scalar, engine::simd, engine::prescan};
+
+inline const char *engine_name(const engine e) noexcept {
+  switch (e) {
+  case engine::scalar:
+    return "scalar";
+  case engine::simd:
+    return "simd";
+  case engine::prescan:
+    return "prescan";
+  default:
+    return "automatic";
+  }
+}
+
+inline bool parse_engine(const std::string &name, engine &e) noexcept {
+  for (const auto candidate : candidates) {
+    if (name == engine_name(candidate)) {
+      e = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// clamp_cast_n with an engine chosen at runtime.
+template <typename From, typename To, typename Policy>
+void clamp_cast_n(const engine e, const From *in, const std::size_t n, To *out,
+                  const Policy &policy CLAMP_CAST_CALL_SITE) noexcept(
+    clamp_cast::detail::is_nothrow_policy<To, Policy>) {
+  switch (e) {
+  case engine::scalar:
+    clamp_cast::clamp_cast_n<engine::scalar>(
+        in, n, out, policy CLAMP_CAST_FORWARD_CALL_SITE);
+    break;
+  case engine::simd:
+    clamp_cast::clamp_cast_n<engine::simd>(
+        in, n, out, policy CLAMP_CAST_FORWARD_CALL_SITE);
+    break;
+  case engine::prescan:
+    clamp_cast::clamp_cast_n<engine::prescan>(
+        in, n, out, policy CLAMP_CAST_FORWARD_CALL_SITE);
+    break;
+  default:
+    clamp_cast::clamp_cast_n(in, n, out, policy CLAMP_CAST_FORWARD_CALL_SITE);
+    break;
+  }
+}
+
+// The choices of all pairs by "from to", the cache file and whether it has
+// been read.
+struct state {
+  std::mutex mutex;
+  std::map<std::string, choice> choices;
+  // The lookups of the pairs that have been resolved so that reset can clear
+  // them.
+  std::vector<std::atomic<std::uint32_t> *> lookups;
+  std::string path;
+  bool initialized{false};
+};
+
+inline state &global_state() {
+  static state instance;
+  return instance;
+}
+
+// Reads lines of the form "float int32 scalar simd simd" and ignores lines it
+// does not understand.
+inline void read_locked(state &s) {
+  std::ifstream file{s.path};
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream words{line};
+    std::string from;
+    std::string to;
+    words >> from >> to;
+    choice c;
+    bool valid{!from.empty() && from[0] != '#'};
+    for (auto &e : c) {
+      std::string name;
+      valid = valid && (words >> name) && parse_engine(name, e);
+    }
+    if (valid) {
+      s.choices[from + " " + to] = c;
+    }
+  }
+}
+
+// Replaces the file so that a concurrent reader never sees a partial one.
+inline void write_locked(const state &s) {
+  if (s.path.empty()) {
+    return;
+  }
+  const std::string temporary{s.path + ".tmp"};
+  {
+    std::ofstream file{temporary};
+    file << "# clamp_cast engines: from to small medium large\n";
+    for (const auto &[pair, c] : s.choices) {
+      file << pair;
+      for (const auto e : c) {
+        file << " " << engine_name(e);
+      }
+      file << "\n";
+    }
+    if (!file) {
+      return;
+    }
+  }
+  std::rename(temporary.c_str(), s.path.c_str());
+}
+
+inline void initialize_locked(state &s) {
+  if (!s.initialized) {
+    s.initialized = true;
+    if (s.path.empty()) {
+      if (const char *path = std::getenv("CLAMP_CAST_TUNE_CACHE")) {
+        s.path = path;
+      }
+    }
+    if (!s.path.empty()) {
+      read_locked(s);
+    }
+  }
+}
+
+template <typename To, typename From> std::string key() {
+  return std::string{clamp_cast::detail::type_name<From>()} + " " +
+         clamp_cast::detail::type_name<To>();
+}
+
+// The sizes that are measured for the size classes.
+constexpr std::size_t sizes[size_classes]{64, 4096, 65536};
+
+// A deterministic spread over the range of To with 1% NaN and 2% out of range
+// values. Measuring only in range values would favor prescan, which is slow
+// as soon as a block contains a value that has to be clamped.
+template <typename To, typename From> std::vector<From> default_sample() {
+  std::vector<From> in(sizes[size_classes - 1]);
+  const auto lower = lower_bound_inclusive<To, From>();
+  const auto upper = upper_bound_exclusive<To, From>();
+  const auto lowest = lower > From{-1e6} ? lower : From{-1e6};
+  const auto highest = upper < From{1e6} ? upper : From{1e6};
+  for (std::size_t i{0}; i < in.size(); ++i) {
+    const auto hash = (i * 2654435761u) % 65536;
+    const auto t = static_cast<From>(hash) / From{65536};
+    switch (hash % 100) {
+    case 0:
+      in[i] = std::numeric_limits<From>::quiet_NaN();
+      break;
+    case 1:
+      in[i] = lower < 0 ? lower * 2 : From{-1};
+      break;
+    case 2:
+      in[i] = upper * 2;
+      break;
+    default:
+      in[i] = lowest + (highest - lowest) * t;
+      break;
+    }
+  }
+  return in;
+}
+
+// Measures the engines on the sample, repeated to the largest size, and
+// returns the fastest one for every size class.
+template <typename To, typename From>
+choice measure(const From *sample, const std::size_t n) {
+  using clock = std::chrono::steady_clock;
+  std::vector<From> in(sizes[size_classes - 1]);
+  for (std::size_t i{0}; i < in.size(); ++i) {
+    in[i] = sample[i % n];
+  }
+  std::vector<To> out(in.size());
+
+  choice result;
+  for (std::size_t c{0}; c < size_classes; ++c) {
+    // Converts about 2^18 elements per measurement.
+    const std::size_t repetitions{(std::size_t{1} << 18) / sizes[c]};
+    double best_time{0};
+    for (const auto e : candidates) {
+      double time{0};
+      for (int run{0}; run < 3; ++run) {
+        const auto start = clock::now();
+        for (std::size_t r{0}; r < repetitions; ++r) {
+          detail::clamp_cast_n(e, in.data(), sizes[c], out.data(),
+                               policy<>{} CLAMP_CAST_NO_CALL_SITE);
+        }
+        const std::chrono::duration<double> duration{clock::now() - start};
+        time = run == 0 || duration.count() < time ? duration.count() : time;
+      }
+      if (e == candidates[0] || time < best_time) {
+        best_time = time;
+        result[c] = e;
+      }
+    }
+  }
+  return result;
+}
+
+// The choice of a pair packed into an integer for a fast lookup: 4 bits per
+// size class and bit 31 for whether it is known.
+constexpr std::uint32_t known{std::uint32_t{1} << 31};
+
+inline std::uint32_t pack(const choice &c) noexcept {
+  std::uint32_t packed{known};
+  for (std::size_t i{0}; i < size_classes; ++i) {
+    packed |= static_cast<std::uint32_t>(c[i]) << (4 * i);
+  }
+  return packed;
+}
+
+template <typename To, typename From> std::atomic<std::uint32_t> &packed() {
+  static std::atomic<std::uint32_t> instance{0};
+  return instance;
+}
+
+// Measures the pair on the sample if it is not known yet or if recalibrate is
+// set. A null sample stands for default_sample.
+template <typename To, typename From>
+choice resolve(const bool recalibrate, const From *sample = nullptr,
+               const std::size_t n = 0) {
+  auto &s = global_state();
+  const std::lock_guard<std::mutex> lock{s.mutex};
+  initialize_locked(s);
+  const auto k = key<To, From>();
+  auto found = s.choices.find(k);
+  if (recalibrate || found == s.choices.end()) {
+    choice c;
+    if (sample == nullptr) {
+      const auto in = default_sample<To, From>();
+      c = measure<To, From>(in.data(), in.size());
+    } else {
+      c = measure<To, From>(sample, n);
+    }
+    found = s.choices.insert_or_assign(k, c).first;
+    write_locked(s);
+  }
+  auto &lookup = packed<To, From>();
+  if (std::find(s.lookups.begin(), s.lookups.end(), &lookup) ==
+      s.lookups.end()) {
+    s.lookups.push_back(&lookup);
+  }
+  lookup.store(pack(found->second), std::memory_order_release);
+  return found->second;
+}
+
+} // namespace detail
+
+// Uses the file at path to keep the choices between processes instead of the
+// one from the environment. Choices that are already known are written to it.
+inline void set_cache_file(std::string path) {
+  auto &s = detail::global_state();
+  const std::lock_guard<std::mutex> lock{s.mutex};
+  s.path = std::move(path);
+  s.initialized = true;
+  detail::read_locked(s);
+  detail::write_locked(s);
+}
+
+// Measures the engines for the pair again and returns the new choice.
+template <typename To, typename From> choice calibrate() {
+  return detail::resolve<To, From>(true);
+}
+
+// Measures the engines for the pair on the n values of sample, which should
+// be representative of the input of the program, and returns the new choice.
+// The choice is kept and written to the cache file like any other.
+template <typename To, typename From>
+choice calibrate(const From *sample, const std::size_t n) {
+  if (n == 0) {
+    throw std::invalid_argument{"the calibration sample is empty"};
+  }
+  return detail::resolve<To, From>(true, sample, n);
+}
+
+// Calibrates all pairs of float or double and an integer type so that later
+// conversions of them do not measure.
+inline void calibrate_all() {
+  const auto calibrate_from = [](auto from) {
+    using From = decltype(from);
+    calibrate<std::int8_t, From>();
+    calibrate<std::uint8_t, From>();
+    calibrate<std::int16_t, From>();
+    calibrate<std::uint16_t, From>();
+    calibrate<std::int32_t, From>();
+    calibrate<std::uint32_t, From>();
+    calibrate<std::int64_t, From>();
+    calibrate<std::uint64_t, From>();
+  };
+  calibrate_from(float{});
+  calibrate_from(double{});
+}
+
+// Forgets all choices so that they are read from the cache file or measured
+// again.
+inline void reset() {
+  auto &s = detail::global_state();
+  const std::lock_guard<std::mutex> lock{s.mutex};
+  s.choices.clear();
+  s.initialized = false;
+  s.path.clear();
+  for (auto *lookup : s.lookups) {
+    lookup->store(0, std::memory_order_release);
+  }
+}
+
+// The engine used for n elements, calibrating the pair if it is not known yet.
+template <typename To, typename From> engine select(const std::size_t n) {
+  auto packed = detail::packed<To, From>().load(std::memory_order_acquire);
+  if ((packed & detail::known) == 0) {
+    packed = detail::pack(detail::resolve<To, From>(false));
+  }
+  return static_cast<engine>((packed >> (4 * size_class(n))) & 15);
+}
+
+// clamp_cast_n with the engine that select chooses. If the calibration fails
+// to allocate then the automatic engine is used.
+template <typename From, typename To, typename Policy = policy<>>
+void clamp_cast_n(const From *in, const std::size_t n, To *out,
+                  const Policy &policy = {} CLAMP_CAST_CALL_SITE) noexcept(
+    clamp_cast::detail::is_nothrow_policy<To, Policy>) {
+  engine e{engine::automatic};
+  try {
+    e = select<To, From>(n);
+  } catch (...) {
+  }
+  detail::clamp_cast_n(e, in, n, out, policy CLAMP_CAST_FORWARD_CALL_SITE);
+}
+
+} // namespace clamp_cast::tune
+
+#endif
@@ -2,6 +2,66 @@
 #define CLAMP_CAST_HPP
 
 #include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Defining CLAMP_CAST_TELEMETRY counts the results of clamp_cast and
+// clamp_cast_n per call site, see clamp-cast-telemetry.hpp. Otherwise the
+// macros below expand to nothing and there is no cost.
+//
+// The call site is a defaulted last parameter because only a default argument
+// is evaluated where the function is called. The parameter is part of the
+// type of the functions, so code that takes their address, like
+// &clamp_cast<int, float>, or passes them as callables, like
+// std::transform(first, last, out, clamp_cast<int, float>), only compiles
+// without CLAMP_CAST_TELEMETRY. A lambda such as
+// [](float x) { return clamp_cast<int>(x); } works either way.
+#ifdef CLAMP_CAST_TELEMETRY
+#include <cstddef>
+
+namespace clamp_cast::telemetry {
+
+// Like std::source_location which is not available in c++17.
+struct call_site {
+  const char *file{nullptr};
+  const char *function{nullptr};
+  unsigned line{0};
+
+  static constexpr call_site
+  current(const char *file = __builtin_FILE(),
+          const char *function = __builtin_FUNCTION(),
+          const unsigned line = __builtin_LINE()) noexcept {
+    return {file, function, line};
+  }
+};
+
+template <typename To, typename From>
+void record(From from, const call_site &site) noexcept;
+
+template <typename To, typename From>
+void record_n(const From *in, std::size_t n, const call_site &site) noexcept;
+
+} // namespace clamp_cast::telemetry
+
+#define CLAMP_CAST_CALL_SITE                                                   \
+  , const ::clamp_cast::telemetry::call_site site =                            \
+        ::clamp_cast::telemetry::call_site::current()
+#define CLAMP_CAST_FORWARD_CALL_SITE , site
+#define CLAMP_CAST_NO_CALL_SITE , ::clamp_cast::telemetry::call_site {}
+#define CLAMP_CAST_RECORD(To, from)                                            \
+  if (!__builtin_is_constant_evaluated()) {                                    \
+    ::clamp_cast::telemetry::record<To>(from, site);                           \
+  }
+#define CLAMP_CAST_RECORD_N(To, in, n)                                         \
+  ::clamp_cast::telemetry::record_n<To>(in, n, site)
+#else
+#define CLAMP_CAST_CALL_SITE
+#define CLAMP_CAST_FORWARD_CALL_SITE
+#define CLAMP_CAST_NO_CALL_SITE
+#define CLAMP_CAST_RECORD(To, from)
+#define CLAMP_CAST_RECORD_N(To, in, n)
+#endif
 
 namespace clamp_cast {
 
@@ -68,6 +128,18 @@ constexpr From upper_bound_exclusive() noexcept {
   }
 }
 
+// How a floating point value is rounded to an integer. Casts and clamp_cast
+// round toward zero.
+enum class rounding {
+  toward_zero,
+  downward,
+  upward,
+  // Ties are rounded to even like std::nearbyint in the default rounding mode.
+  to_nearest,
+  // Ties are rounded away from zero like std::round.
+  to_nearest_away,
+};
+
 // Safe cast from a floating point type to an integer type by clamping to its
 // bounds if the value would be outside.
 // NaN is converted to 0.
@@ -77,7 +149,7 @@ constexpr From upper_bound_exclusive() noexcept {
 // https://en.cppreference.com/w/cpp/language/implicit_conversion
 // section "Floating–integral conversions"
 template <typename To, typename From>
-constexpr To clamp_cast(const From from) noexcept {
+constexpr To clamp_cast(const From from CLAMP_CAST_CALL_SITE) noexcept {
   // Floating point numbers can represent a large range of powers of 2 exactly.
   // For example, even a 32 bit float can represent 2**64. In this common case
   // we can represent the minimum and maximum values of To exactly in From.
@@ -100,6 +172,7 @@ constexpr To clamp_cast(const From from) noexcept {
   // the branching but this doesn't work for upper bounds as they are a power of
   // 2 minus 1 which is likely not exactly representable in From.
 
+  CLAMP_CAST_RECORD(To, from)
   if (is_nan(from)) {
     return 0;
   } else if (from < lower_bound_inclusive<To, From>()) {
@@ -111,6 +184,337 @@ constexpr To clamp_cast(const From from) noexcept {
   }
 }
 
+// Thrown by the report handler.
+class conversion_error : public std::range_error {
+public:
+  using std::range_error::range_error;
+};
+
+// Handlers decide what clamp_cast returns for a value that it cannot convert.
+// They are called with the value that clamp_cast returns by default: the
+// nearest bound of To or 0 for NaN.
+
+// Returns the default value.
+struct saturate {
+  template <typename To>
+  static constexpr To handle(const To saturated, const char *) noexcept {
+    return saturated;
+  }
+};
+
+namespace detail {
+
+// Whether the integer value is in the range of To. Signed and unsigned values
+// are compared by value like std::in_range in C++20, so -1 is not in the range
+// of uint32_t.
+template <typename To, typename From>
+constexpr bool in_range(const From value) noexcept {
+  static_assert(std::is_integral_v<To> && std::is_integral_v<From>);
+  using limits = std::numeric_limits<To>;
+  if constexpr (std::is_signed_v<From> == std::is_signed_v<To>) {
+    return value >= limits::min() && value <= limits::max();
+  } else if constexpr (std::is_signed_v<From>) {
+    return value >= 0 &&
+           static_cast<std::make_unsigned_t<From>>(value) <= limits::max();
+  } else {
+    return value <= static_cast<std::make_unsigned_t<To>>(limits::max());
+  }
+}
+
+} // namespace detail
+
+// Returns Value. A Value outside of the range of To, like sentinel<-1> for
+// uint32_t, does not compile.
+template <auto Value> struct sentinel {
+  template <typename To>
+  static constexpr To handle(const To, const char *) noexcept {
+    static_assert(detail::in_range<To>(Value),
+                  "the sentinel must be representable in To");
+    return static_cast<To>(Value);
+  }
+};
+
+// Throws conversion_error.
+struct report {
+  template <typename To>
+  [[noreturn]] static To handle(const To, const char *what) {
+    throw conversion_error{what};
+  }
+};
+
+// Selects the handlers clamp_cast uses for NaN, for values below the bounds of
+// To and for values above them. The default policy<> saturates like
+// clamp_cast without a policy and generates the same code.
+//
+// For example policy<sentinel<INT32_MIN>> maps NaN to INT32_MIN and
+// policy<report, report, report> throws for every value that does not fit.
+//
+// clamp_cast calls on_nan, on_underflow and on_overflow on the policy object so
+// other types with these members can be used as policies too.
+template <typename Nan = saturate, typename Underflow = saturate,
+          typename Overflow = saturate>
+struct policy {
+  template <typename To>
+  constexpr To on_nan() const
+      noexcept(noexcept(Nan::handle(To{}, ""))) {
+    return Nan::handle(To{0}, "clamp_cast: NaN");
+  }
+
+  template <typename To>
+  constexpr To on_underflow() const
+      noexcept(noexcept(Underflow::handle(To{}, ""))) {
+    return Underflow::handle(std::numeric_limits<To>::min(),
+                             "clamp_cast: value below the range of To");
+  }
+
+  template <typename To>
+  constexpr To on_overflow() const
+      noexcept(noexcept(Overflow::handle(To{}, ""))) {
+    return Overflow::handle(std::numeric_limits<To>::max(),
+                            "clamp_cast: value above the range of To");
+  }
+};
+
+// A sticky record of what clamp_cast had to clamp, like the floating point
+// exception flags of <cfenv> but deterministic and cheap. Check it once after
+// a batch of conversions instead of after every conversion.
+class saturation_flags {
+public:
+  static constexpr unsigned nan{1};
+  static constexpr unsigned underflow{2};
+  static constexpr unsigned overflow{4};
+  static constexpr unsigned any{nan | underflow | overflow};
+
+  constexpr void raise(const unsigned events) noexcept { bits_ |= events; }
+  constexpr void clear() noexcept { bits_ = 0; }
+  // Whether any of the events have been raised since the last clear.
+  constexpr bool test(const unsigned events = any) const noexcept {
+    return (bits_ & events) != 0;
+  }
+  constexpr unsigned bits() const noexcept { return bits_; }
+
+private:
+  unsigned bits_{0};
+};
+
+// The flags of the calling thread that sticky uses by default.
+inline saturation_flags &thread_saturation_flags() noexcept {
+  thread_local saturation_flags flags;
+  return flags;
+}
+
+// A policy that saturates like policy<> and raises the corresponding event in
+// a saturation_flags.
+class sticky {
+public:
+  sticky() noexcept : flags_{&thread_saturation_flags()} {}
+  explicit sticky(saturation_flags &flags) noexcept : flags_{&flags} {}
+
+  template <typename To> constexpr To on_nan() const noexcept {
+    flags_->raise(saturation_flags::nan);
+    return 0;
+  }
+
+  template <typename To> constexpr To on_underflow() const noexcept {
+    flags_->raise(saturation_flags::underflow);
+    return std::numeric_limits<To>::min();
+  }
+
+  template <typename To> constexpr To on_overflow() const noexcept {
+    flags_->raise(saturation_flags::overflow);
+    return std::numeric_limits<To>::max();
+  }
+
+  saturation_flags &flags() const noexcept { return *flags_; }
+
+private:
+  saturation_flags *flags_;
+};
+
+namespace detail {
+
+template <typename To, typename Policy>
+constexpr bool is_nothrow_policy{
+    noexcept(std::declval<const Policy &>().template on_nan<To>()) &&
+    noexcept(std::declval<const Policy &>().template on_underflow<To>()) &&
+    noexcept(std::declval<const Policy &>().template on_overflow<To>())};
+
+// Whether the policy behaves like policy<>. Bulk kernels use this to skip the
+// separate handling of values outside of the bounds.
+template <typename Policy>
+constexpr bool is_saturating_policy{
+    std::is_same_v<Policy, policy<saturate, saturate, saturate>>};
+
+} // namespace detail
+
+// clamp_cast with a policy that selects what is returned for values that do
+// not fit into To. The checks are the same as in clamp_cast without a policy.
+template <typename To, typename From, typename Policy>
+constexpr To clamp_cast(const From from, const Policy &policy
+                            CLAMP_CAST_CALL_SITE) noexcept(
+    detail::is_nothrow_policy<To, Policy>) {
+  if constexpr (detail::is_saturating_policy<Policy>) {
+    return clamp_cast<To>(from CLAMP_CAST_FORWARD_CALL_SITE);
+  } else {
+    CLAMP_CAST_RECORD(To, from)
+    if (is_nan(from)) {
+      return policy.template on_nan<To>();
+    } else if (from < lower_bound_inclusive<To, From>()) {
+      return policy.template on_underflow<To>();
+    } else if (from >= upper_bound_exclusive<To, From>()) {
+      return policy.template on_overflow<To>();
+    } else {
+      return static_cast<To>(from);
+    }
+  }
+}
+
+// How checked_clamp_cast converted a value.
+enum class conversion_status {
+  // The value is an integer in the range of To.
+  exact,
+  // The value is in the range of To and its fractional part was discarded.
+  truncated,
+  // The value was below the range of To and clamped to its minimum.
+  saturated_low,
+  // The value was above the range of To and clamped to its maximum.
+  saturated_high,
+  // The value was NaN and converted to 0.
+  nan,
+};
+
+template <typename To> struct checked_result {
+  To value;
+  conversion_status status;
+};
+
+// clamp_cast that also returns how the value was converted. The value is the
+// same as the one clamp_cast returns. Values in the range of To take one extra
+// comparison to tell exact from truncated conversions.
+template <typename To, typename From>
+constexpr checked_result<To> checked_clamp_cast(const From from) noexcept {
+  if (is_nan(from)) {
+    return {0, conversion_status::nan};
+  } else if (from < lower_bound_inclusive<To, From>()) {
+    return {std::numeric_limits<To>::min(), conversion_status::saturated_low};
+  } else if (from >= upper_bound_exclusive<To, From>()) {
+    return {std::numeric_limits<To>::max(), conversion_status::saturated_high};
+  } else {
+    const auto to = static_cast<To>(from);
+    // Converting back is exact, see detail::compare.
+    return {to, static_cast<From>(to) == from ? conversion_status::exact
+                                              : conversion_status::truncated};
+  }
+}
+
+namespace detail {
+
+// The result of comparing a floating point value with an integer.
+enum class ordering { less, equal, greater, unordered };
+
+// Compares a floating point value with an integer without converting either of
+// them into a type that cannot represent the other exactly.
+template <typename Float, typename Int>
+constexpr ordering compare(const Float f, const Int i) noexcept {
+  static_assert(std::numeric_limits<Int>::is_integer);
+
+  // Outside of the bounds the float is smaller or larger than every Int.
+  if (is_nan(f)) {
+    return ordering::unordered;
+  } else if (f < lower_bound_inclusive<Int, Float>()) {
+    return ordering::less;
+  } else if (f >= upper_bound_exclusive<Int, Float>()) {
+    return ordering::greater;
+  }
+
+  // Inside of the bounds the truncated value fits into Int. Because
+  // truncated <= |f| < truncated + 1 the truncated value already decides the
+  // comparison unless it is equal to i. In that case we compare the fractional
+  // part by converting back, which is exact because truncating a floating
+  // point value always results in a representable value.
+  const auto truncated = static_cast<Int>(f);
+  if (truncated < i) {
+    return ordering::less;
+  } else if (truncated > i) {
+    return ordering::greater;
+  }
+  const auto back = static_cast<Float>(truncated);
+  if (f < back) {
+    return ordering::less;
+  } else if (f > back) {
+    return ordering::greater;
+  } else {
+    return ordering::equal;
+  }
+}
+
+// Compares t with u where exactly one of them is a floating point value and the
+// other an integer. The result is from the perspective of t.
+template <typename T, typename U>
+constexpr ordering compare_mixed(const T t, const U u) noexcept {
+  static_assert(std::numeric_limits<T>::is_integer !=
+                    std::numeric_limits<U>::is_integer,
+                "compare exactly one floating point value with one integer");
+  if constexpr (std::numeric_limits<T>::is_integer) {
+    const auto flipped = compare(u, t);
+    if (flipped == ordering::less) {
+      return ordering::greater;
+    } else if (flipped == ordering::greater) {
+      return ordering::less;
+    } else {
+      return flipped;
+    }
+  } else {
+    return compare(t, u);
+  }
+}
+
+} // namespace detail
+
+// Exact comparisons between a floating point value and an integer in either
+// order. Converting the integer to the floating point type (what the built in
+// operators do) loses precision: `16777217 == 16777216.0f` is true while
+// `cmp_equal(16777217, 16777216.0f)` is false.
+// Like the built in operators every comparison involving NaN is false except
+// cmp_not_equal.
+template <typename T, typename U>
+constexpr bool cmp_equal(const T t, const U u) noexcept {
+  return detail::compare_mixed(t, u) == detail::ordering::equal;
+}
+
+template <typename T, typename U>
+constexpr bool cmp_not_equal(const T t, const U u) noexcept {
+  return !cmp_equal(t, u);
+}
+
+template <typename T, typename U>
+constexpr bool cmp_less(const T t, const U u) noexcept {
+  return detail::compare_mixed(t, u) == detail::ordering::less;
+}
+
+template <typename T, typename U>
+constexpr bool cmp_greater(const T t, const U u) noexcept {
+  return detail::compare_mixed(t, u) == detail::ordering::greater;
+}
+
+template <typename T, typename U>
+constexpr bool cmp_less_equal(const T t, const U u) noexcept {
+  const auto ordering = detail::compare_mixed(t, u);
+  return ordering == detail::ordering::less ||
+         ordering == detail::ordering::equal;
+}
+
+template <typename T, typename U>
+constexpr bool cmp_greater_equal(const T t, const U u) noexcept {
+  const auto ordering = detail::compare_mixed(t, u);
+  return ordering == detail::ordering::greater ||
+         ordering == detail::ordering::equal;
+}
+
 } // namespace clamp_cast
 
+#ifdef CLAMP_CAST_TELEMETRY
+#include "clamp-cast-telemetry.hpp"
+#endif
+
 #endif
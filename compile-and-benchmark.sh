@@ -0,0 +1,5 @@
+#!/bin/sh
+set -e
+flags="-std=c++17 -Werror -Wall -Wextra -Wconversion -O2 -DNDEBUG -pthread"
+c++ $flags benchmark.cpp -o benchmark && ./benchmark "$@"
+c++ $flags -DCLAMP_CAST_TELEMETRY benchmark.cpp -o benchmark && ./benchmark "$@"
@@ -0,0 +1,4 @@
+#!/bin/sh
+set -e
+flags="-std=c++17 -Werror -Wall -Wextra -Wconversion -O2 -DNDEBUG -pthread"
+c++ $flags convert.cpp -o convert && ./convert "$@"
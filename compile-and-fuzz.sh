@@ -0,0 +1,4 @@
+#!/bin/sh
+set -e
+flags="-std=c++17 -Wall -Wextra -O1 -g -fsanitize=fuzzer,undefined -fno-sanitize-recover=undefined"
+clang++ $flags fuzz.cpp -o fuzz && ./fuzz "$@"
@@ -1,2 +1,6 @@
 #!/bin/sh
-c++ -std=c++17 -Werror -Wall -Wextra -Wconversion -fsanitize=undefined -g -fno-omit-frame-pointer test.cpp && ./a.out
+set -e
+flags="-std=c++17 -Werror -Wall -Wextra -Wconversion -fsanitize=undefined -g -fno-omit-frame-pointer -pthread"
+c++ $flags test.cpp && ./a.out
+c++ $flags -DCLAMP_CAST_TELEMETRY test.cpp && ./a.out
+c++ $flags -DCLAMP_CAST_PROFILE test.cpp && ./a.out
@@ -0,0 +1,4 @@
+#!/bin/sh
+set -e
+flags="-std=c++17 -Werror -Wall -Wextra -Wconversion -O2 -pthread"
+c++ $flags verify.cpp -o verify && ./verify "$@"
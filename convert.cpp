@@ -0,0 +1,297 @@
+// Converts a file of raw floating point values to a file of raw integers with
+// clamp_cast::file::convert, for example
+//
+//   ./convert --round nearest --scale 32767 audio.f32 audio.i16
+//
+// The types are taken from the extensions of the files or from --from and
+// --to. A .npy input is converted to a .npy output of the type of --to with
+// clamp_cast::npy::convert. The files are mapped by default and --io pipeline
+// reads and writes them with io_uring or threads instead, see
+// clamp-cast-pipeline.hpp. Compile it with ./compile-and-convert.sh, which
+// also runs it with its arguments. It prints the throughput and how many
+// values were clamped.
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "clamp-cast-file.hpp"
+#include "clamp-cast-npy.hpp"
+#include "clamp-cast-pipeline.hpp"
+
+namespace {
+
+const char *const usage{
+    "usage: convert [options] input output\n"
+    "  --from f32|f64|npy      the input type, by default the extension, npy\n"
+    "                          writes a .npy file of the type of --to\n"
+    "  --to i8|u8|i16|u16|i32|u32|i64|u64\n"
+    "                          the output type, by default the extension\n"
+    "  --scale x --offset y    convert x * value + y, 1 and 0 by default\n"
+    "  --round zero|down|up|nearest|away\n"
+    "                          how to round to integers, zero by default\n"
+    "  --input-order little|big|native\n"
+    "  --output-order little|big|native\n"
+    "                          the byte order of the files, native by default\n"
+    "  --threads n             0 by default for every hardware thread\n"
+    "  --io mmap|pipeline|uring|threads\n"
+    "                          map the files, mmap by default, or read and\n"
+    "                          write them with io_uring if possible, with\n"
+    "                          io_uring or with threads\n"
+    "  --buffers n --buffer-size MiB\n"
+    "                          the buffers of the pipeline, 3 of 4 MiB by\n"
+    "                          default\n"
+    "  --drop-cache 1|0        whether the pipeline drops the files from the\n"
+    "                          page cache, 0 by default\n"};
+
+std::string extension(const std::string &path) {
+  const auto dot = path.rfind('.');
+  const auto slash = path.rfind('/');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    return "";
+  }
+  return path.substr(dot + 1);
+}
+
+double parse_number(const std::string &text) {
+  char *end{nullptr};
+  const double number{std::strtod(text.c_str(), &end)};
+  if (text.empty() || *end != '\0') {
+    throw std::invalid_argument{"not a number: " + text};
+  }
+  return number;
+}
+
+// A non-negative integer of at most max.
+std::size_t parse_count(const std::string &text, const std::size_t max) {
+  if (text.empty()) {
+    throw std::invalid_argument{"not a non-negative integer: " + text};
+  }
+  std::size_t count{0};
+  for (const char c : text) {
+    if (c < '0' || c > '9') {
+      throw std::invalid_argument{"not a non-negative integer: " + text};
+    }
+    const auto digit = static_cast<std::size_t>(c - '0');
+    if (digit > max || count > (max - digit) / 10) {
+      throw std::invalid_argument{"too large: " + text};
+    }
+    count = count * 10 + digit;
+  }
+  return count;
+}
+
+clamp_cast::rounding parse_rounding(const std::string &text) {
+  if (text == "zero") {
+    return clamp_cast::rounding::toward_zero;
+  } else if (text == "down") {
+    return clamp_cast::rounding::downward;
+  } else if (text == "up") {
+    return clamp_cast::rounding::upward;
+  } else if (text == "nearest") {
+    return clamp_cast::rounding::to_nearest;
+  } else if (text == "away") {
+    return clamp_cast::rounding::to_nearest_away;
+  }
+  throw std::invalid_argument{"unknown rounding: " + text};
+}
+
+clamp_cast::file::byte_order parse_order(const std::string &text) {
+  if (text == "little") {
+    return clamp_cast::file::byte_order::little;
+  } else if (text == "big") {
+    return clamp_cast::file::byte_order::big;
+  } else if (text == "native") {
+    return clamp_cast::file::byte_order::native;
+  }
+  throw std::invalid_argument{"unknown byte order: " + text};
+}
+
+// The settings of the command line.
+struct settings {
+  clamp_cast::file::options options;
+  bool pipelined{false};
+  clamp_cast::file::pipeline_options pipeline;
+};
+
+clamp_cast::file::io parse_io(const std::string &text, bool &pipelined) {
+  pipelined = text != "mmap";
+  if (text == "mmap" || text == "pipeline") {
+    return clamp_cast::file::io::automatic;
+  } else if (text == "uring") {
+    return clamp_cast::file::io::uring;
+  } else if (text == "threads") {
+    return clamp_cast::file::io::threads;
+  }
+  throw std::invalid_argument{"unknown io: " + text};
+}
+
+template <typename To, typename From>
+clamp_cast::file::result convert(const char *input, const char *output,
+                                 const settings &settings) {
+  if (settings.pipelined) {
+    return clamp_cast::file::convert_pipelined<To, From>(
+        input, output, settings.options, settings.pipeline);
+  }
+  return clamp_cast::file::convert<To, From>(input, output, settings.options);
+}
+
+// Calls f with a null pointer of the integer type that name stands for.
+template <typename F> auto with_integer_type(const std::string &name, F f) {
+  if (name == "i8") {
+    return f(static_cast<int8_t *>(nullptr));
+  } else if (name == "u8") {
+    return f(static_cast<uint8_t *>(nullptr));
+  } else if (name == "i16") {
+    return f(static_cast<int16_t *>(nullptr));
+  } else if (name == "u16") {
+    return f(static_cast<uint16_t *>(nullptr));
+  } else if (name == "i32") {
+    return f(static_cast<int32_t *>(nullptr));
+  } else if (name == "u32") {
+    return f(static_cast<uint32_t *>(nullptr));
+  } else if (name == "i64") {
+    return f(static_cast<int64_t *>(nullptr));
+  } else if (name == "u64") {
+    return f(static_cast<uint64_t *>(nullptr));
+  }
+  throw std::invalid_argument{"unknown output type: " + name};
+}
+
+template <typename From>
+clamp_cast::file::result convert_from(const std::string &to, const char *input,
+                                      const char *output,
+                                      const settings &settings) {
+  return with_integer_type(to, [&](auto *type) {
+    using To = std::remove_pointer_t<decltype(type)>;
+    return convert<To, From>(input, output, settings);
+  });
+}
+
+// Converts a .npy file whose header gives the input type and byte order.
+clamp_cast::file::result convert_npy(const std::string &to, const char *input,
+                                     const char *output,
+                                     const settings &settings) {
+  return with_integer_type(to, [&](auto *type) {
+    using To = std::remove_pointer_t<decltype(type)>;
+    if (settings.pipelined) {
+      return clamp_cast::npy::convert_pipelined<To>(
+          input, output, settings.options, settings.pipeline);
+    }
+    return clamp_cast::npy::convert<To>(input, output, settings.options);
+  });
+}
+
+int run(const int argc, char **argv) {
+  std::string from;
+  std::string to;
+  settings settings;
+  auto &options = settings.options;
+  std::string paths[2];
+  int path_count{0};
+  for (int i{1}; i < argc; ++i) {
+    const std::string argument{argv[i]};
+    if (argument == "--help") {
+      std::cout << usage;
+      return 0;
+    }
+    if (argument.rfind("--", 0) != 0) {
+      if (path_count == 2) {
+        throw std::invalid_argument{"too many files"};
+      }
+      paths[path_count++] = argument;
+      continue;
+    }
+    if (i + 1 == argc) {
+      throw std::invalid_argument{argument + " needs a value"};
+    }
+    const std::string value{argv[++i]};
+    if (argument == "--from") {
+      from = value;
+    } else if (argument == "--to") {
+      to = value;
+    } else if (argument == "--scale") {
+      options.scale = parse_number(value);
+    } else if (argument == "--offset") {
+      options.offset = parse_number(value);
+    } else if (argument == "--round") {
+      options.round = parse_rounding(value);
+    } else if (argument == "--input-order") {
+      options.input_order = parse_order(value);
+    } else if (argument == "--output-order") {
+      options.output_order = parse_order(value);
+    } else if (argument == "--threads") {
+      options.threads = static_cast<unsigned>(
+          parse_count(value, std::numeric_limits<unsigned>::max()));
+    } else if (argument == "--io") {
+      settings.pipeline.backend = parse_io(value, settings.pipelined);
+    } else if (argument == "--buffers") {
+      settings.pipeline.buffers = static_cast<unsigned>(
+          parse_count(value, std::numeric_limits<unsigned>::max()));
+    } else if (argument == "--buffer-size") {
+      settings.pipeline.buffer_size =
+          parse_count(value, std::numeric_limits<std::size_t>::max() >> 20)
+          << 20;
+    } else if (argument == "--drop-cache") {
+      settings.pipeline.drop_cache = parse_count(value, 1) != 0;
+    } else {
+      throw std::invalid_argument{"unknown option: " + argument};
+    }
+  }
+  if (path_count != 2) {
+    std::cerr << usage;
+    return 2;
+  }
+  if (from.empty()) {
+    from = extension(paths[0]);
+  }
+  if (to.empty()) {
+    to = extension(paths[1]);
+  }
+
+  clamp_cast::file::result result;
+  if (from == "npy") {
+    if (to == "npy") {
+      throw std::invalid_argument{"--to is needed for a .npy output"};
+    }
+    result = convert_npy(to, paths[0].c_str(), paths[1].c_str(), settings);
+  } else if (from == "f32") {
+    result = convert_from<float>(to, paths[0].c_str(), paths[1].c_str(),
+                                 settings);
+  } else if (from == "f64") {
+    result = convert_from<double>(to, paths[0].c_str(), paths[1].c_str(),
+                                  settings);
+  } else {
+    throw std::invalid_argument{"unknown input type: " + from};
+  }
+
+  std::cout << paths[0] << " -> " << paths[1] << ": " << result.values
+            << " values in " << result.seconds << " s";
+  // An empty file can take no measurable time.
+  if (result.seconds > 0.0) {
+    std::cout << ", "
+              << static_cast<double>(result.bytes) / result.seconds / 1e9
+              << " GB/s read and written";
+  }
+  std::cout << "\nclamped: " << result.nans << " NaN, " << result.underflows
+            << " below, " << result.overflows << " above the range of " << to
+            << "\n";
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    return run(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << "convert: " << e.what() << "\n";
+    return 1;
+  }
+}
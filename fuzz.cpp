@@ -0,0 +1,232 @@
+// A libFuzzer target that converts the input bytes as floating point values
+// with every engine of the bulk functions and every kind of policy and checks
+// that the results are the same as converting every element with the scalar
+// clamp_cast. Compile and run it with clang, for example with
+// ./compile-and-fuzz.sh .
+//
+// The first byte selects the types and the second one the policy and the
+// offsets of the input and output arrays so that the kernels see unaligned
+// arrays. The remaining bytes are the values.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "clamp-cast-analyzed.hpp"
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast.hpp"
+
+namespace {
+
+using clamp_cast::engine;
+
+[[noreturn]] void fail(const char *what, const std::size_t i) {
+  std::fprintf(stderr, "%s at element %zu\n", what, i);
+  std::abort();
+}
+
+// Converts in with every engine and compares with the scalar clamp_cast. A
+// policy that throws stops both at the same element.
+template <engine Engine, typename To, typename From, typename Policy>
+void check_engine(const std::vector<From> &in, const std::size_t offset,
+                  const Policy &policy) {
+  const std::size_t n{in.size() - offset};
+  std::vector<To> expected(n);
+  std::size_t converted{0};
+  try {
+    for (; converted < n; ++converted) {
+      expected[converted] =
+          clamp_cast::clamp_cast<To>(in[offset + converted], policy);
+    }
+  } catch (const clamp_cast::conversion_error &) {
+  }
+
+  // The output is offset like the input so that both can be unaligned.
+  std::vector<To> out(in.size());
+  try {
+    clamp_cast::clamp_cast_n<Engine>(in.data() + offset, n, out.data() + offset,
+                                     policy);
+    if (converted != n) {
+      fail("clamp_cast_n did not throw", converted);
+    }
+  } catch (const clamp_cast::conversion_error &) {
+    if (converted == n) {
+      fail("clamp_cast_n threw but clamp_cast did not", 0);
+    }
+  }
+  for (std::size_t i{0}; i < converted; ++i) {
+    if (out[offset + i] != expected[i]) {
+      fail("clamp_cast_n differs from clamp_cast", i);
+    }
+  }
+}
+
+template <engine Engine, typename To, typename From>
+void check_sticky(const std::vector<From> &in, const std::size_t offset) {
+  const std::size_t n{in.size() - offset};
+  clamp_cast::saturation_flags expected_flags;
+  clamp_cast::saturation_flags flags;
+  std::vector<To> out(in.size());
+  clamp_cast::clamp_cast_n<Engine>(in.data() + offset, n, out.data() + offset,
+                                   clamp_cast::sticky{flags});
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto expected = clamp_cast::clamp_cast<To>(
+        in[offset + i], clamp_cast::sticky{expected_flags});
+    if (out[offset + i] != expected) {
+      fail("clamp_cast_n with sticky differs from clamp_cast", i);
+    }
+  }
+  if (flags.bits() != expected_flags.bits()) {
+    fail("the flags of sticky differ", n);
+  }
+}
+
+template <typename To, typename From>
+void check_analyzed(const std::vector<From> &in, const std::size_t offset) {
+  const std::size_t n{in.size() - offset};
+  const clamp_cast::analyzed_buffer<From> analyzed{in.data() + offset, n};
+  clamp_cast::saturation_flags expected_flags;
+  clamp_cast::saturation_flags flags;
+  std::vector<To> out(n);
+  clamp_cast::clamp_cast_n(analyzed, out.data(), clamp_cast::sticky{flags});
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto expected = clamp_cast::clamp_cast<To>(
+        in[offset + i], clamp_cast::sticky{expected_flags});
+    if (out[i] != expected) {
+      fail("clamp_cast_n of an analyzed_buffer differs from clamp_cast", i);
+    }
+  }
+  if (flags.bits() != expected_flags.bits()) {
+    fail("the flags of the analyzed_buffer differ", n);
+  }
+}
+
+template <engine Engine, typename To, typename From>
+void check_checked(const std::vector<From> &in, const std::size_t offset) {
+  using clamp_cast::conversion_status;
+  const std::size_t n{in.size() - offset};
+  std::vector<To> out(in.size());
+  std::vector<std::uint64_t> selection((n + 63) / 64);
+  const auto summary = clamp_cast::checked_clamp_cast_n<Engine>(
+      in.data() + offset, n, out.data() + offset, selection.data());
+  clamp_cast::saturation_summary expected_summary{0, n};
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto expected = clamp_cast::checked_clamp_cast<To>(in[offset + i]);
+    const bool saturated{expected.status != conversion_status::exact &&
+                         expected.status != conversion_status::truncated};
+    if (out[offset + i] != expected.value ||
+        ((selection[i / 64] >> (i % 64)) & 1) != saturated) {
+      fail("checked_clamp_cast_n differs from checked_clamp_cast", i);
+    }
+    if (saturated && expected_summary.count++ == 0) {
+      expected_summary.first = i;
+    }
+    expected_summary.nans += expected.status == conversion_status::nan;
+    expected_summary.underflows +=
+        expected.status == conversion_status::saturated_low;
+    expected_summary.overflows +=
+        expected.status == conversion_status::saturated_high;
+  }
+  if (summary.count != expected_summary.count ||
+      summary.first != expected_summary.first ||
+      summary.nans != expected_summary.nans ||
+      summary.underflows != expected_summary.underflows ||
+      summary.overflows != expected_summary.overflows) {
+    fail("the summary of checked_clamp_cast_n differs", n);
+  }
+}
+
+template <engine Engine, typename To, typename From>
+void check_policy(const std::vector<From> &in, const std::size_t offset,
+                  const unsigned policy) {
+  using namespace clamp_cast;
+  switch (policy) {
+  case 0:
+    check_engine<Engine, To>(in, offset, clamp_cast::policy<>{});
+    break;
+  case 1:
+    check_engine<Engine, To>(
+        in, offset, clamp_cast::policy<sentinel<42>, saturate, sentinel<7>>{});
+    break;
+  case 2:
+    check_engine<Engine, To>(in, offset,
+                             clamp_cast::policy<report, saturate, report>{});
+    break;
+  case 3:
+    check_engine<Engine, To>(
+        in, offset, clamp_cast::policy<sentinel<0>, report, saturate>{});
+    break;
+  case 4:
+    check_sticky<Engine, To>(in, offset);
+    break;
+  default:
+    check_checked<Engine, To>(in, offset);
+    break;
+  }
+}
+
+template <typename To, typename From>
+void check(const std::uint8_t *data, const std::size_t size,
+           const unsigned options) {
+  const std::size_t offset{options & 3};
+  const unsigned policy{(options >> 2) % 6};
+  std::vector<From> in(offset + size / sizeof(From));
+  if (size >= sizeof(From)) {
+    std::memcpy(in.data() + offset, data, size / sizeof(From) * sizeof(From));
+  }
+  check_policy<engine::scalar, To>(in, offset, policy);
+  check_policy<engine::simd, To>(in, offset, policy);
+  check_policy<engine::prescan, To>(in, offset, policy);
+  check_policy<engine::automatic, To>(in, offset, policy);
+  check_analyzed<To>(in, offset);
+}
+
+template <typename From>
+void check_from(const std::uint8_t *data, const std::size_t size,
+                const unsigned to, const unsigned options) {
+  switch (to) {
+  case 0:
+    return check<std::int8_t, From>(data, size, options);
+  case 1:
+    return check<std::uint8_t, From>(data, size, options);
+  case 2:
+    return check<std::int16_t, From>(data, size, options);
+  case 3:
+    return check<std::uint16_t, From>(data, size, options);
+  case 4:
+    return check<std::int32_t, From>(data, size, options);
+  case 5:
+    return check<std::uint32_t, From>(data, size, options);
+  case 6:
+    return check<std::int64_t, From>(data, size, options);
+  default:
+    return check<std::uint64_t, From>(data, size, options);
+  }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data,
+                                      const std::size_t size) {
+  if (size < 2) {
+    return 0;
+  }
+  const unsigned types{data[0]};
+  const unsigned options{data[1]};
+  const unsigned to{types % 8};
+  switch (types / 8 % 3) {
+  case 0:
+    check_from<float>(data + 2, size - 2, to, options);
+    break;
+  case 1:
+    check_from<double>(data + 2, size - 2, to, options);
+    break;
+  default:
+    check_from<long double>(data + 2, size - 2, to, options);
+    break;
+  }
+  return 0;
+}
@@ -1,8 +1,36 @@
+#include <algorithm>
+#include <atomic>
 #include <cfloat>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "clamp-cast-analyzed.hpp"
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast-file.hpp"
+#include "clamp-cast-npy.hpp"
+#include "clamp-cast-parallel.hpp"
+#include "clamp-cast-pipeline.hpp"
+#include "clamp-cast-ring.hpp"
+#include "clamp-cast-shm.hpp"
+#include "clamp-cast-stream.hpp"
+#include "clamp-cast-tune.hpp"
 #include "clamp-cast.hpp"
 
 template <typename To, typename From> bool test_case(From from, To expected) {
@@ -74,8 +102,1592 @@ bool test() {
   return success;
 }
 
+bool test_compare() {
+  static_assert(clamp_cast::cmp_less(0.5f, 1));
+  static_assert(clamp_cast::cmp_greater(1, 0.5f));
+
+  bool success{true};
+
+  // 2**24 + 1 is not representable as float so the built in operators compare
+  // it as 2**24.
+  const int64_t big{16777217};
+  const float big_f{16777216.0f};
+  success &= !clamp_cast::cmp_equal(big_f, big);
+  success &= clamp_cast::cmp_less(big_f, big);
+  success &= clamp_cast::cmp_greater(big, big_f);
+  success &= clamp_cast::cmp_equal(big_f, big - 1);
+  success &= clamp_cast::cmp_less_equal(big_f, big - 1);
+  success &= clamp_cast::cmp_greater_equal(big_f, big - 1);
+
+  success &= clamp_cast::cmp_less(-0.5f, 0u);
+  success &= clamp_cast::cmp_greater(-0.5f, -1);
+  success &= clamp_cast::cmp_greater(std::exp2f(63.0), INT64_MAX);
+  success &= clamp_cast::cmp_less(std::nextafter(std::exp2f(63.0), 0.0f),
+                                  INT64_MAX);
+  success &= clamp_cast::cmp_greater(std::exp2f(64.0), UINT64_MAX);
+  success &= clamp_cast::cmp_less(-INFINITY, INT64_MIN);
+  success &= clamp_cast::cmp_equal(-std::exp2(63.0), INT64_MIN);
+  success &= !clamp_cast::cmp_equal(NAN, 0);
+  success &= !clamp_cast::cmp_less(NAN, 0);
+  success &= !clamp_cast::cmp_greater(NAN, 0);
+  success &= clamp_cast::cmp_not_equal(NAN, 0);
+
+  // The filters must agree with the scalar comparisons. The values are chosen
+  // around the threshold where converting it to float is inexact.
+  std::vector<float> values;
+  for (float f{big_f}, i{0}; i < 8; ++i) {
+    values.push_back(f);
+    values.push_back(-f);
+    f = std::nextafter(f, INFINITY);
+  }
+  values.push_back(NAN);
+  values.push_back(INFINITY);
+  values.push_back(-INFINITY);
+  values.push_back(0.0f);
+  while (values.size() < 150) {
+    values.push_back(static_cast<float>(values.size()) * 1e5f);
+  }
+  std::vector<uint64_t> selection((values.size() + 63) / 64);
+  for (const int64_t threshold : {big, -big, big + 1, int64_t{0}}) {
+    const auto check = [&](auto filter, auto compare, const char *name) {
+      filter(values.data(), values.size(), threshold, selection.data());
+      for (size_t i{0}; i < values.size(); ++i) {
+        const bool selected{((selection[i / 64] >> (i % 64)) & 1) != 0};
+        if (selected != compare(values[i], threshold)) {
+          std::cout << name << "(" << values[i] << ", " << threshold
+                    << ") == " << selected << "\n";
+          success = false;
+        }
+      }
+      success &= (selection.back() >> (values.size() % 64)) == 0;
+    };
+    check(clamp_cast::filter_less<float, int64_t>,
+          clamp_cast::cmp_less<float, int64_t>, "filter_less");
+    check(clamp_cast::filter_less_equal<float, int64_t>,
+          clamp_cast::cmp_less_equal<float, int64_t>, "filter_less_equal");
+    check(clamp_cast::filter_greater<float, int64_t>,
+          clamp_cast::cmp_greater<float, int64_t>, "filter_greater");
+    check(clamp_cast::filter_greater_equal<float, int64_t>,
+          clamp_cast::cmp_greater_equal<float, int64_t>,
+          "filter_greater_equal");
+    check(clamp_cast::filter_equal<float, int64_t>,
+          clamp_cast::cmp_equal<float, int64_t>, "filter_equal");
+    check(clamp_cast::filter_not_equal<float, int64_t>,
+          clamp_cast::cmp_not_equal<float, int64_t>, "filter_not_equal");
+  }
+
+  return success;
+}
+
+template <typename From>
+From round_reference(const From from, const clamp_cast::rounding mode) {
+  switch (mode) {
+  case clamp_cast::rounding::toward_zero:
+    return std::trunc(from);
+  case clamp_cast::rounding::downward:
+    return std::floor(from);
+  case clamp_cast::rounding::upward:
+    return std::ceil(from);
+  case clamp_cast::rounding::to_nearest:
+    return std::nearbyint(from);
+  case clamp_cast::rounding::to_nearest_away:
+    return std::round(from);
+  }
+  return from;
+}
+
+// Checks cast_interval against rounding and clamping every value.
+template <typename To, typename From>
+bool test_cast_interval(const std::vector<From> &values,
+                        const std::vector<To> &bounds) {
+  using clamp_cast::rounding;
+  bool success{true};
+  for (const auto mode :
+       {rounding::toward_zero, rounding::downward, rounding::upward,
+        rounding::to_nearest, rounding::to_nearest_away}) {
+    for (const To low : bounds) {
+      for (const To high : bounds) {
+        const auto range = clamp_cast::cast_interval<To, From>(low, high, mode);
+        for (const From from : values) {
+          const To to{
+              clamp_cast::clamp_cast<To>(round_reference(from, mode))};
+          const bool expected{!clamp_cast::is_nan(from) && low <= to &&
+                              to <= high};
+          if (range.contains(from) != expected) {
+            std::cout << "cast_interval(" << +low << ", " << +high << ", "
+                      << static_cast<int>(mode) << ").contains(" << from
+                      << ") != " << expected << "\n";
+            success = false;
+          }
+        }
+      }
+    }
+  }
+  return success;
+}
+
+bool test_interval() {
+  bool success{true};
+
+  std::vector<float> small{NAN, INFINITY, -INFINITY};
+  for (float f{-300.0f}; f <= 300.0f; f += 0.25f) {
+    small.push_back(f);
+    small.push_back(std::nextafter(f, INFINITY));
+    small.push_back(std::nextafter(f, -INFINITY));
+  }
+  success &= test_cast_interval<int8_t>(
+      small, std::vector<int8_t>{-128, -127, -3, -2, -1, 0, 1, 2, 3, 126, 127});
+  success &= test_cast_interval<uint8_t>(
+      small, std::vector<uint8_t>{0, 1, 2, 3, 128, 254, 255});
+
+  // Around 2**23 float stops representing halves and around 2**24 it stops
+  // representing all integers.
+  std::vector<float> large{NAN};
+  for (const float start : {std::exp2f(23.0), std::exp2f(24.0),
+                            std::exp2f(31.0), -std::exp2f(23.0),
+                            -std::exp2f(24.0), -std::exp2f(31.0)}) {
+    float up{start};
+    float down{start};
+    for (int i{0}; i < 8; ++i) {
+      large.push_back(up);
+      large.push_back(down);
+      up = std::nextafter(up, INFINITY);
+      down = std::nextafter(down, -INFINITY);
+    }
+  }
+  const int32_t p23{8388608};
+  const int32_t p24{16777216};
+  success &= test_cast_interval<int32_t>(
+      large,
+      std::vector<int32_t>{INT32_MIN, INT32_MIN + 1, -p24 - 1, -p24, -p24 + 1,
+                           -p23 - 1, -p23, -p23 + 1, 0, p23 - 1, p23, p23 + 1,
+                           p24 - 1, p24, p24 + 1, INT32_MAX - 1, INT32_MAX});
+
+  std::vector<double> large_d{NAN};
+  for (const double start : {std::exp2(52.0), std::exp2(53.0), std::exp2(63.0),
+                             -std::exp2(52.0), -std::exp2(53.0),
+                             -std::exp2(63.0)}) {
+    double up{start};
+    double down{start};
+    for (int i{0}; i < 8; ++i) {
+      large_d.push_back(up);
+      large_d.push_back(down);
+      up = std::nextafter(up, INFINITY);
+      down = std::nextafter(down, -INFINITY);
+    }
+  }
+  const int64_t p52{int64_t{1} << 52};
+  const int64_t p53{int64_t{1} << 53};
+  success &= test_cast_interval<int64_t>(
+      large_d, std::vector<int64_t>{INT64_MIN, INT64_MIN + 1, -p53 - 1, -p53,
+                                    -p53 + 1, -p52 - 1, -p52, -p52 + 1, 0,
+                                    p52 - 1, p52, p52 + 1, p53 - 1, p53,
+                                    p53 + 1, INT64_MAX - 1, INT64_MAX});
+
+  std::vector<float> values{small};
+  values.insert(values.end(), large.begin(), large.end());
+  const auto range = clamp_cast::cast_interval<int32_t, float>(
+      -p24 - 1, p24 + 1, clamp_cast::rounding::to_nearest);
+  std::vector<uint64_t> selection((values.size() + 63) / 64);
+  clamp_cast::filter_in(values.data(), values.size(), range, selection.data());
+  for (size_t i{0}; i < values.size(); ++i) {
+    const bool selected{((selection[i / 64] >> (i % 64)) & 1) != 0};
+    success &= selected == range.contains(values[i]);
+  }
+
+  return success;
+}
+
+// Values around the bounds of To and other special values.
+template <typename To, typename From> std::vector<From> interesting_values() {
+  std::vector<From> values{NAN,
+                           INFINITY,
+                           -INFINITY,
+                           std::numeric_limits<From>::max(),
+                           std::numeric_limits<From>::lowest(),
+                           std::numeric_limits<From>::denorm_min(),
+                           0.0,
+                           -0.0,
+                           0.5,
+                           -0.5,
+                           1.0,
+                           -1.0};
+  for (const From bound : {clamp_cast::lower_bound_inclusive<To, From>(),
+                           clamp_cast::upper_bound_exclusive<To, From>()}) {
+    From up{bound};
+    From down{bound};
+    for (int i{0}; i < 4; ++i) {
+      values.push_back(up);
+      values.push_back(down);
+      values.push_back(up - static_cast<From>(0.5));
+      up = std::nextafter(up, static_cast<From>(INFINITY));
+      down = std::nextafter(down, static_cast<From>(-INFINITY));
+    }
+  }
+  for (int i{0}; values.size() < 200; ++i) {
+    values.push_back(static_cast<From>(i * i * i) *
+                     static_cast<From>(i % 2 == 0 ? 1.5 : -0.75));
+  }
+  return values;
+}
+
+// Checks the bulk engines against the scalar clamp_cast with every alignment
+// and a length that does not fill the last vector.
+template <typename To, typename From, typename Policy = clamp_cast::policy<>>
+bool test_bulk(const Policy &policy = {}) {
+  const auto values = interesting_values<To, From>();
+  std::vector<To> expected(values.size());
+  for (size_t i{0}; i < values.size(); ++i) {
+    expected[i] = clamp_cast::clamp_cast<To>(values[i], policy);
+  }
+
+  bool success{true};
+  const auto check = [&](auto convert, const char *name) {
+    for (size_t offset{0}; offset < 4; ++offset) {
+      const size_t n{values.size() - offset - 3};
+      std::vector<To> result(n);
+      convert(values.data() + offset, n, result.data());
+      for (size_t i{0}; i < n; ++i) {
+        if (result[i] != expected[i + offset]) {
+          std::cout << name << " clamp_cast_n(" << values[i + offset]
+                    << ") == " << +result[i]
+                    << " != " << +expected[i + offset] << "\n";
+          success = false;
+        }
+      }
+    }
+  };
+  check(
+      [&](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::scalar>(in, n, out,
+                                                             policy);
+      },
+      "scalar");
+  check(
+      [&](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::simd>(in, n, out, policy);
+      },
+      "simd");
+  check(
+      [&](const From *in, size_t n, To *out) {
+        clamp_cast::clamp_cast_n<clamp_cast::engine::prescan>(in, n, out,
+                                                              policy);
+      },
+      "prescan");
+  return success;
+}
+
+template <typename To> bool test_bulk_all_sources() {
+  using clamp_cast::policy;
+  using clamp_cast::saturate;
+  using clamp_cast::sentinel;
+  bool success{true};
+  success &= test_bulk<To, float>();
+  success &= test_bulk<To, double>();
+  success &= test_bulk<To, float>(policy<sentinel<1>>{});
+  success &= test_bulk<To, double>(policy<sentinel<1>, sentinel<2>>{});
+  success &= test_bulk<To, float>(
+      policy<saturate, sentinel<3>, sentinel<4>>{});
+  return success;
+}
+
+bool test_policy() {
+  using clamp_cast::policy;
+  using clamp_cast::report;
+  using clamp_cast::saturate;
+  using clamp_cast::sentinel;
+
+  static_assert(clamp_cast::clamp_cast<int32_t>(
+                    NAN, policy<sentinel<INT32_MIN>>{}) == INT32_MIN);
+  // The check of sentinel, which rejects policy<sentinel<-1>> for uint32_t at
+  // compile time.
+  static_assert(!clamp_cast::detail::in_range<uint32_t>(-1) &&
+                !clamp_cast::detail::in_range<uint64_t>(INT64_MIN) &&
+                !clamp_cast::detail::in_range<int8_t>(128u) &&
+                !clamp_cast::detail::in_range<int64_t>(UINT64_MAX) &&
+                clamp_cast::detail::in_range<uint8_t>(255) &&
+                clamp_cast::detail::in_range<int64_t>(UINT32_MAX) &&
+                clamp_cast::detail::in_range<int16_t>(-32768));
+  static_assert(clamp_cast::clamp_cast<uint32_t>(
+                    NAN, policy<sentinel<UINT32_MAX>>{}) == UINT32_MAX);
+  static_assert(noexcept(clamp_cast::clamp_cast<int32_t>(1.0f, policy<>{})));
+  static_assert(!noexcept(
+      clamp_cast::clamp_cast<int32_t>(1.0f, policy<report, report, report>{})));
+
+  bool success{true};
+  success &= clamp_cast::clamp_cast<int16_t>(-1e9f, policy<saturate>{}) ==
+             INT16_MIN;
+  success &= clamp_cast::clamp_cast<int16_t>(
+                 -1e9f, policy<saturate, sentinel<0>>{}) == 0;
+  success &= clamp_cast::clamp_cast<int16_t>(
+                 1e9f, policy<saturate, saturate, sentinel<-1>>{}) == -1;
+
+  const policy<report, report, report> strict;
+  success &= clamp_cast::clamp_cast<int16_t>(-1.5f, strict) == -1;
+  for (const float from : {NAN, -1e9f, 1e9f}) {
+    try {
+      clamp_cast::clamp_cast<int16_t>(from, strict);
+      success = false;
+    } catch (const clamp_cast::conversion_error &) {
+    }
+  }
+  std::vector<float> values(100, 1.0f);
+  values[50] = NAN;
+  std::vector<int8_t> out(values.size());
+  try {
+    clamp_cast::clamp_cast_n(values.data(), values.size(), out.data(), strict);
+    success = false;
+  } catch (const clamp_cast::conversion_error &) {
+    success &= out[49] == 1;
+  }
+
+  success &= test_bulk_all_sources<int8_t>();
+  success &= test_bulk_all_sources<uint8_t>();
+  success &= test_bulk_all_sources<int16_t>();
+  success &= test_bulk_all_sources<uint16_t>();
+  success &= test_bulk_all_sources<int32_t>();
+  success &= test_bulk_all_sources<uint32_t>();
+  success &= test_bulk_all_sources<int64_t>();
+  success &= test_bulk_all_sources<uint64_t>();
+
+  return success;
+}
+
+template <typename To, typename From> bool test_checked_bulk() {
+  using clamp_cast::conversion_status;
+  const auto values = interesting_values<To, From>();
+  bool success{true};
+  const auto check = [&](auto convert, const char *name) {
+    std::vector<To> out(values.size());
+    std::vector<uint64_t> selection((values.size() + 63) / 64);
+    const auto summary =
+        convert(values.data(), values.size(), out.data(), selection.data());
+    size_t count{0};
+    size_t first{values.size()};
+    size_t by_status[5]{};
+    for (size_t i{0}; i < values.size(); ++i) {
+      const auto expected = clamp_cast::checked_clamp_cast<To>(values[i]);
+      ++by_status[static_cast<int>(expected.status)];
+      const bool saturated{expected.status != conversion_status::exact &&
+                           expected.status != conversion_status::truncated};
+      const bool selected{((selection[i / 64] >> (i % 64)) & 1) != 0};
+      if (out[i] != expected.value || selected != saturated) {
+        std::cout << name << " checked_clamp_cast_n(" << values[i]
+                  << ") == " << +out[i] << ", " << selected << "\n";
+        success = false;
+      }
+      if (saturated) {
+        first = std::min(first, i);
+        ++count;
+      }
+    }
+    success &= summary.count == count && summary.first == first &&
+               summary.nans ==
+                   by_status[static_cast<int>(conversion_status::nan)] &&
+               summary.underflows ==
+                   by_status[static_cast<int>(
+                       conversion_status::saturated_low)] &&
+               summary.overflows ==
+                   by_status[static_cast<int>(
+                       conversion_status::saturated_high)] &&
+               summary.nans != 0 && summary.underflows != 0 &&
+               summary.overflows != 0;
+  };
+  check(clamp_cast::checked_clamp_cast_n<clamp_cast::engine::scalar, From, To>,
+        "scalar");
+  check(clamp_cast::checked_clamp_cast_n<clamp_cast::engine::simd, From, To>,
+        "simd");
+  check(clamp_cast::checked_clamp_cast_n<clamp_cast::engine::prescan, From, To>,
+        "prescan");
+  return success;
+}
+
+bool test_checked() {
+  using clamp_cast::checked_clamp_cast;
+  using clamp_cast::conversion_status;
+
+  static_assert(checked_clamp_cast<int8_t>(1.0f).status ==
+                conversion_status::exact);
+
+  bool success{true};
+  success &= checked_clamp_cast<int8_t>(-0.0f).status ==
+             conversion_status::exact;
+  success &= checked_clamp_cast<int8_t>(1.5f).status ==
+             conversion_status::truncated;
+  // Values below the range are saturated even if truncating them would give
+  // the minimum too.
+  success &= checked_clamp_cast<int8_t>(-128.5f).status ==
+             conversion_status::saturated_low;
+  success &= checked_clamp_cast<int8_t>(-129.0f).status ==
+             conversion_status::saturated_low;
+  success &= checked_clamp_cast<int8_t>(128.0f).status ==
+             conversion_status::saturated_high;
+  success &= checked_clamp_cast<int8_t>(NAN).status == conversion_status::nan;
+  success &= checked_clamp_cast<uint8_t>(-0.5f).status ==
+             conversion_status::saturated_low;
+  success &= checked_clamp_cast<uint8_t>(-1.0f).value == 0;
+
+  success &= test_checked_bulk<int8_t, float>();
+  success &= test_checked_bulk<uint16_t, float>();
+  success &= test_checked_bulk<int32_t, float>();
+  success &= test_checked_bulk<uint32_t, float>();
+  success &= test_checked_bulk<int16_t, double>();
+  success &= test_checked_bulk<int64_t, double>();
+
+  std::vector<float> in_range(1000, 1.0f);
+  std::vector<int32_t> out(in_range.size());
+  const auto summary = clamp_cast::checked_clamp_cast_n(
+      in_range.data(), in_range.size(), out.data(), nullptr);
+  success &= summary.count == 0 && summary.first == in_range.size();
+
+  return success;
+}
+
+template <typename To, typename From> bool test_sticky_bulk() {
+  using clamp_cast::saturation_flags;
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  std::vector<To> out(values.size());
+  // One value of each kind at a time at a position that is converted by a
+  // vector and by the scalar tail.
+  for (const auto position : {size_t{20}, values.size() - 1}) {
+    for (const auto kind : {From{1}, static_cast<From>(NAN),
+                            static_cast<From>(-INFINITY),
+                            static_cast<From>(INFINITY)}) {
+      std::vector<From> in(values.size(), From{1});
+      in[position] = kind;
+      unsigned expected{0};
+      if (clamp_cast::is_nan(kind)) {
+        expected = saturation_flags::nan;
+      } else if (kind < 0) {
+        expected = saturation_flags::underflow;
+      } else if (kind > 1) {
+        expected = saturation_flags::overflow;
+      }
+      saturation_flags flags;
+      clamp_cast::clamp_cast_n<clamp_cast::engine::simd>(
+          in.data(), in.size(), out.data(), clamp_cast::sticky{flags});
+      success &= flags.bits() == expected;
+    }
+  }
+  saturation_flags flags;
+  clamp_cast::clamp_cast_n(values.data(), values.size(), out.data(),
+                           clamp_cast::sticky{flags});
+  success &= flags.bits() == saturation_flags::any;
+  std::vector<To> expected(values.size());
+  clamp_cast::clamp_cast_n(values.data(), values.size(), expected.data());
+  success &= out == expected;
+  return success;
+}
+
+bool test_sticky() {
+  using clamp_cast::saturation_flags;
+  using clamp_cast::sticky;
+  bool success{true};
+
+  saturation_flags flags;
+  success &= clamp_cast::clamp_cast<int8_t>(1.0f, sticky{flags}) == 1;
+  success &= !flags.test();
+  success &= clamp_cast::clamp_cast<int8_t>(1000.0f, sticky{flags}) == 127;
+  success &= flags.test(saturation_flags::overflow);
+  success &= !flags.test(saturation_flags::nan | saturation_flags::underflow);
+  success &= clamp_cast::clamp_cast<int8_t>(NAN, sticky{flags}) == 0;
+  success &= flags.test(saturation_flags::nan);
+  flags.clear();
+  success &= !flags.test();
+
+  clamp_cast::thread_saturation_flags().clear();
+  success &= clamp_cast::clamp_cast<uint8_t>(-1.0, sticky{}) == 0;
+  success &= clamp_cast::thread_saturation_flags().bits() ==
+             saturation_flags::underflow;
+  clamp_cast::thread_saturation_flags().clear();
+
+  success &= test_sticky_bulk<int8_t, float>();
+  success &= test_sticky_bulk<uint16_t, float>();
+  success &= test_sticky_bulk<int32_t, float>();
+  success &= test_sticky_bulk<int32_t, double>();
+  success &= test_sticky_bulk<uint64_t, double>();
+
+  return success;
+}
+
+// Checks engine::prescan on several blocks where only some are in range.
+template <typename To, typename From> bool test_prescan_type() {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  // Blocks in range, with NaN in the last element, with one value out of
+  // range in the first element and a partial block in range.
+  std::vector<From> in(8 * 8192 / sizeof(From) + 5);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = static_cast<From>(i % 100);
+  }
+  in[2 * 8192 / sizeof(From) - 1] = NAN;
+  in[3 * 8192 / sizeof(From)] = values[1];
+  for (size_t i{4 * 8192 / sizeof(From)}; i < in.size() - 5; ++i) {
+    in[i] = values[i % values.size()];
+  }
+  std::vector<To> out(in.size());
+  clamp_cast::saturation_flags flags;
+  clamp_cast::clamp_cast_n<clamp_cast::engine::prescan>(
+      in.data(), in.size(), out.data(), clamp_cast::sticky{flags});
+  clamp_cast::saturation_flags expected_flags;
+  for (size_t i{0}; i < in.size(); ++i) {
+    const auto expected =
+        clamp_cast::clamp_cast<To>(in[i], clamp_cast::sticky{expected_flags});
+    success &= out[i] == expected;
+  }
+  success &= flags.bits() == expected_flags.bits();
+  return success;
+}
+
+bool test_prescan() {
+  bool success{true};
+  success &= test_prescan_type<int8_t, float>();
+  success &= test_prescan_type<uint16_t, float>();
+  success &= test_prescan_type<int32_t, float>();
+  success &= test_prescan_type<uint32_t, double>();
+  success &= test_prescan_type<int64_t, double>();
+  success &= test_prescan_type<uint64_t, long double>();
+  if (!success) {
+    std::cout << "prescan failed\n";
+  }
+  return success;
+}
+
+// Converts blocks that alternate between in range values and bursts of values
+// outside of the bounds and checks the results and the mode switches.
+template <typename To, typename From, typename Policy = clamp_cast::policy<>>
+bool test_adaptive_type(const Policy &policy = {}) {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  constexpr size_t block{clamp_cast::adaptive_converter<To, From>::block_size};
+  clamp_cast::adaptive_converter<To, From, Policy> convert{policy};
+  success &= convert.optimistic();
+  for (int burst{0}; burst < 4; ++burst) {
+    const bool clipping{burst % 2 == 1};
+    // Every block has a tail that is not a multiple of the vector size.
+    std::vector<From> in(40 * block + 3);
+    for (size_t i{0}; i < in.size(); ++i) {
+      in[i] = clipping ? values[i % values.size()]
+                       : static_cast<From>(static_cast<int>(i % 100) - 50);
+    }
+    if (std::is_unsigned_v<To> && !clipping) {
+      for (auto &value : in) {
+        value = std::abs(value);
+      }
+    }
+    std::vector<To> out(in.size());
+    convert(in.data(), in.size(), out.data());
+    for (size_t i{0}; i < in.size(); ++i) {
+      success &= out[i] == clamp_cast::clamp_cast<To>(in[i], policy);
+    }
+    // SIMD kernels that saturate are always used without checks.
+    success &= convert.optimistic() ==
+               (!clipping || (clamp_cast::has_simd_kernel<To, From>() &&
+                              std::is_same_v<Policy, clamp_cast::policy<>>));
+  }
+  return success;
+}
+
+bool test_adaptive() {
+  bool success{true};
+  success &= test_adaptive_type<int8_t, float>();
+  success &= test_adaptive_type<uint16_t, float>();
+  success &= test_adaptive_type<int32_t, float>();
+  success &= test_adaptive_type<uint32_t, float>();
+  success &= test_adaptive_type<int32_t, double>();
+  success &= test_adaptive_type<int64_t, double>();
+  success &= test_adaptive_type<uint64_t, long double>();
+  success &= test_adaptive_type<int16_t, float>(
+      clamp_cast::policy<clamp_cast::sentinel<-1>>{});
+  if (!success) {
+    std::cout << "adaptive_converter failed\n";
+  }
+  return success;
+}
+
+// Checks the non-temporal stores of engine::streaming, which is only used for
+// large outputs, directly on small unaligned arrays.
+template <typename To, typename From, typename Policy = clamp_cast::policy<>>
+bool test_streaming_type(const Policy &policy = {}) {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  std::vector<From> in(values.size() * 3);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = i % 2 == 0 ? values[i % values.size()]
+                       : static_cast<From>(i % 100);
+  }
+  for (size_t offset{0}; offset < 4; ++offset) {
+    std::vector<To> out(in.size() + offset);
+    clamp_cast::detail::clamp_cast_n_streaming(in.data(), in.size(),
+                                               out.data() + offset, policy);
+    for (size_t i{0}; i < in.size(); ++i) {
+      success &= out[offset + i] == clamp_cast::clamp_cast<To>(in[i], policy);
+    }
+  }
+  return success;
+}
+
+bool test_streaming() {
+  bool success{true};
+  success &= test_streaming_type<int8_t, float>();
+  success &= test_streaming_type<uint16_t, float>();
+  success &= test_streaming_type<int32_t, double>();
+  success &= test_streaming_type<int64_t, double>();
+  success &= test_streaming_type<uint64_t, long double>();
+  success &= test_streaming_type<int16_t, float>(
+      clamp_cast::policy<clamp_cast::sentinel<-1>>{});
+  success &= test_streaming_type<int64_t, float>(
+      clamp_cast::policy<clamp_cast::sentinel<-1>>{});
+  clamp_cast::saturation_flags flags;
+  success &= test_streaming_type<int32_t, float>(clamp_cast::sticky{flags});
+  success &= flags.test(clamp_cast::saturation_flags::any);
+
+  // Small outputs use automatic.
+  std::vector<float> in{1.5f, NAN, 1e10f};
+  std::vector<int32_t> out(in.size());
+  clamp_cast::clamp_cast_n<clamp_cast::engine::streaming>(in.data(), in.size(),
+                                                          out.data());
+  success &= out[0] == 1 && out[1] == 0 && out[2] == INT32_MAX;
+  if (!success) {
+    std::cout << "streaming failed\n";
+  }
+  return success;
+}
+
+// Pushes a stream in chunks of many sizes and compares with converting it at
+// once.
+template <typename To, typename From> bool test_stream_type() {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  std::vector<From> in(5000);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = i % 5 == 0 ? values[i % values.size()]
+                       : static_cast<From>(i % 100);
+  }
+  std::vector<To> expected(in.size());
+  clamp_cast::saturation_flags expected_flags;
+  clamp_cast::clamp_cast_n(in.data(), in.size(), expected.data(),
+                           clamp_cast::sticky{expected_flags});
+
+  clamp_cast::saturation_flags flags;
+  clamp_cast::stream_converter<To, From, clamp_cast::sticky> stream{
+      clamp_cast::sticky{flags}};
+  std::vector<To> out;
+  const To *buffer{nullptr};
+  size_t i{0};
+  for (size_t chunk{0}; i < in.size(); ++chunk) {
+    const size_t n{std::min(chunk % 37, in.size() - i)};
+    const auto converted = stream.push(in.data() + i, n);
+    out.insert(out.end(), converted.begin(), converted.end());
+    i += n;
+    // The buffer is reused once it has grown to the largest chunk.
+    if (chunk > 37 && converted.size() != 0) {
+      success &= buffer == nullptr || buffer == converted.data();
+      buffer = converted.data();
+    }
+    success &= stream.pending() < stream.alignment;
+  }
+  const auto rest = stream.flush();
+  out.insert(out.end(), rest.begin(), rest.end());
+  success &= stream.pending() == 0;
+  success &= out == expected;
+  success &= flags.bits() == expected_flags.bits();
+  return success;
+}
+
+bool test_stream() {
+  bool success{true};
+  success &= test_stream_type<int8_t, float>();
+  success &= test_stream_type<uint16_t, float>();
+  success &= test_stream_type<int32_t, double>();
+  success &= test_stream_type<int64_t, double>();
+  success &= test_stream_type<uint64_t, long double>();
+
+  // A whole vector is returned as soon as it is complete.
+  clamp_cast::stream_converter<int16_t, float> stream;
+  const std::vector<float> in(stream.alignment, 2.5f);
+  success &= stream.push(in.data(), in.size() - 1).size() == 0 ||
+             stream.alignment == 1;
+  success &= stream.push(in.data(), 1).size() ==
+             (stream.alignment == 1 ? 1 : stream.alignment);
+  success &= stream.push(in).size() == in.size();
+  success &= stream.flush().empty();
+
+  // span only views contiguous containers of elements that convert to T.
+  using clamp_cast::span;
+  static_assert(std::is_convertible_v<std::vector<float> &, span<float>>);
+  static_assert(std::is_convertible_v<float(&)[4], span<const float>>);
+  static_assert(
+      std::is_convertible_v<const std::vector<float> &, span<const float>>);
+  static_assert(
+      !std::is_constructible_v<span<float>, const std::vector<float> &>);
+  static_assert(!std::is_constructible_v<span<float>, std::vector<double> &>);
+  static_assert(!std::is_constructible_v<span<float>, std::map<int, float> &>);
+  static_assert(!std::is_constructible_v<span<float>, float &>);
+  if (!success) {
+    std::cout << "stream_converter failed\n";
+  }
+  return success;
+}
+
+bool test_ring() {
+  bool success{true};
+  clamp_cast::conversion_ring<int16_t, float> ring{100};
+  success &= ring.capacity() == 128;
+  std::vector<float> in(200);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = static_cast<float>(i) * 1000.5f - 50000.0f;
+  }
+  success &= ring.push(in.data(), 100) == 100;
+  success &= ring.push(in.data() + 100, 100) == 28;
+  auto front = ring.front();
+  success &= front.size() == 128;
+  for (size_t i{0}; i < front.size(); ++i) {
+    success &= front[i] == clamp_cast::clamp_cast<int16_t>(in[i]);
+  }
+  ring.pop(60);
+  // The values wrap around the end of the storage.
+  success &= ring.push(in.data() + 128, 72) == 60;
+  std::vector<int16_t> out(200);
+  success &= ring.pop(out.data(), out.size()) == 128;
+  for (size_t i{0}; i < 128; ++i) {
+    success &= out[i] == clamp_cast::clamp_cast<int16_t>(in[60 + i]);
+  }
+  success &= ring.front().empty();
+
+  // A producer and a consumer thread.
+  constexpr size_t n{size_t{1} << 18};
+  clamp_cast::conversion_ring<int32_t, double> shared{1000};
+  std::thread producer{[&] {
+    std::vector<double> frame(77);
+    for (size_t i{0}; i < n;) {
+      for (size_t j{0}; j < frame.size(); ++j) {
+        frame[j] = static_cast<double>(i + j) + 0.25;
+      }
+      const size_t count{std::min(frame.size(), n - i)};
+      const size_t pushed{shared.push(frame.data(), count)};
+      if (pushed == 0) {
+        std::this_thread::yield();
+      }
+      i += pushed;
+    }
+  }};
+  size_t received{0};
+  while (received < n) {
+    const auto values = shared.front();
+    if (values.empty()) {
+      std::this_thread::yield();
+    }
+    for (size_t i{0}; i < values.size(); ++i) {
+      success &= values[i] == static_cast<int32_t>(received + i);
+    }
+    shared.pop(values.size());
+    received += values.size();
+  }
+  producer.join();
+  if (!success) {
+    std::cout << "conversion_ring failed\n";
+  }
+  return success;
+}
+
+#ifdef __linux__
+// The value i of frame f that the producer process publishes. Some are NaN,
+// below or above the range of int16.
+float shared_value(const unsigned f, const size_t i) {
+  if (i % 97 == 3) {
+    return NAN;
+  }
+  return static_cast<float>(f) * 400.0f - static_cast<float>(i) * 37.5f;
+}
+
+bool test_shared_channel() {
+  bool success{true};
+  using channel_type = clamp_cast::shared_channel<int16_t, float>;
+  auto channel = channel_type::create(1000, 4);
+  success &= channel.capacity() == 1000 && channel.slots() == 4;
+  // Frames would skip slots when the counters wrap.
+  try {
+    channel_type::create(1000, 3);
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  constexpr unsigned frames{200};
+  const pid_t child{fork()};
+  if (child == 0) {
+    // The producer process maps the segment again from the file descriptor
+    // and converts the frames from the staging area.
+    auto producer = channel_type::open(channel.fd());
+    for (unsigned f{0}; f < frames; ++f) {
+      const auto staging = producer.staging();
+      const size_t n{f * 7 % (staging.size() + 1)};
+      for (size_t i{0}; i < n; ++i) {
+        staging[i] = shared_value(f, i);
+      }
+      producer.publish(n);
+    }
+    _exit(0);
+  }
+  success &= child > 0;
+  for (unsigned f{0}; success && f < frames; ++f) {
+    // Does not wait forever if the producer failed.
+    if (!channel.wait_for(std::chrono::seconds{10})) {
+      success = false;
+      break;
+    }
+    const auto frame = channel.front();
+    success &= frame.size() == f * 7 % 1001;
+    for (size_t i{0}; i < frame.size(); ++i) {
+      success &=
+          frame[i] == clamp_cast::clamp_cast<int16_t>(shared_value(f, i));
+    }
+    channel.pop();
+  }
+  int status{0};
+  success &= child > 0 && waitpid(child, &status, 0) == child &&
+             WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  success &= !channel.wait_for(std::chrono::milliseconds{1});
+
+  // A named segment and a frame from the memory of the producer.
+  const std::string name{"/clamp-cast-test-" + std::to_string(getpid())};
+  {
+    auto producer =
+        clamp_cast::shared_channel<uint8_t, double>::create(name.c_str(), 64);
+    auto consumer =
+        clamp_cast::shared_channel<uint8_t, double>::open(name.c_str());
+    const std::vector<double> in{-1.0, 0.5, 254.9, 300.0};
+    producer.publish(in.data(), in.size());
+    const auto frame = consumer.front();
+    success &= frame.size() == in.size();
+    for (size_t i{0}; i < in.size(); ++i) {
+      success &= frame[i] == clamp_cast::clamp_cast<uint8_t>(in[i]);
+    }
+    consumer.pop();
+    // A frame larger than the capacity is rejected and a corrupted length is
+    // clamped.
+    const std::vector<double> large(65);
+    try {
+      producer.publish(large.data(), large.size());
+      success = false;
+    } catch (const std::invalid_argument &) {
+    }
+    producer.publish(in.data(), in.size());
+    auto *const length = reinterpret_cast<uint64_t *>(
+        const_cast<uint8_t *>(consumer.front().data()) - 64);
+    *length = UINT64_MAX;
+    success &= consumer.front().size() == 64;
+    consumer.pop();
+    // The segment holds other types.
+    try {
+      clamp_cast::shared_channel<int8_t, double>::open(producer.fd());
+      success = false;
+    } catch (const std::invalid_argument &) {
+    }
+  }
+  shm_unlink(name.c_str());
+  if (!success) {
+    std::cout << "shared_channel failed\n";
+  }
+  return success;
+}
+// Converts a file of big endian doubles to little endian int16 with scaling
+// and rounding on 3 threads, mapped and pipelined.
+bool test_file() {
+  bool success{true};
+  const std::string input{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                          ".f64"};
+  const std::string output{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                           ".i16"};
+  std::vector<double> in(100000);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = i % 101 == 0 ? NAN : (static_cast<double>(i) - 50000.0) * 0.75;
+  }
+  {
+    std::ofstream file{input, std::ios::binary};
+    for (const double value : in) {
+      const auto swapped = clamp_cast::file::detail::byte_swap(value);
+      file.write(reinterpret_cast<const char *>(&swapped), sizeof(swapped));
+    }
+  }
+  clamp_cast::file::options options;
+  options.scale = 2.0;
+  options.offset = 0.5;
+  options.round = clamp_cast::rounding::to_nearest;
+  options.input_order = clamp_cast::file::byte_order::big;
+  options.output_order = clamp_cast::file::byte_order::little;
+  options.threads = 3;
+  const auto result = clamp_cast::file::convert<int16_t, double>(
+      input.c_str(), output.c_str(), options);
+  const auto read_output = [&] {
+    std::vector<int16_t> out(in.size());
+    std::ifstream file{output, std::ios::binary | std::ios::ate};
+    success &=
+        static_cast<size_t>(file.tellg()) == out.size() * sizeof(int16_t);
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(out.data()),
+              static_cast<std::streamsize>(out.size() * sizeof(int16_t)));
+    return out;
+  };
+  const auto out = read_output();
+  clamp_cast::file::result expected;
+  for (size_t i{0}; i < in.size(); ++i) {
+    const double value{std::nearbyint(in[i] * 2.0 + 0.5)};
+    success &= out[i] == clamp_cast::clamp_cast<int16_t>(value);
+    expected.nans += std::isnan(value);
+    expected.underflows += value < -32768.0;
+    expected.overflows += value >= 32768.0;
+  }
+  success &= result.values == in.size() && result.nans == expected.nans &&
+             result.underflows == expected.underflows &&
+             result.overflows == expected.overflows && expected.nans != 0 &&
+             expected.underflows != 0 && expected.overflows != 0;
+
+  // The pipeline with 13 chunks in 2 buffers gives the same file.
+  clamp_cast::file::pipeline_options pipeline;
+  pipeline.buffer_size = 8192 * sizeof(double);
+  pipeline.buffers = 2;
+  pipeline.drop_cache = true;
+  std::vector<clamp_cast::file::io> backends{clamp_cast::file::io::threads};
+  if (clamp_cast::file::uring_available()) {
+    backends.push_back(clamp_cast::file::io::uring);
+  }
+  for (const auto backend : backends) {
+    pipeline.backend = backend;
+    const auto pipelined = clamp_cast::file::convert_pipelined<int16_t, double>(
+        input.c_str(), output.c_str(), options, pipeline);
+    success &= read_output() == out && pipelined.values == result.values &&
+               pipelined.nans == result.nans &&
+               pipelined.underflows == result.underflows &&
+               pipelined.overflows == result.overflows;
+  }
+  // Converting a file into itself throws before the input is truncated.
+  try {
+    clamp_cast::file::convert<int16_t, double>(input.c_str(), input.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  try {
+    clamp_cast::file::convert_pipelined<int16_t, double>(input.c_str(),
+                                                         input.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  success &= static_cast<size_t>(
+                 std::ifstream{input, std::ios::binary | std::ios::ate}
+                     .tellg()) == in.size() * sizeof(double);
+  // The size of the input is not a multiple of 8.
+  std::ofstream{input, std::ios::binary} << "abc";
+  try {
+    clamp_cast::file::convert<int16_t, double>(input.c_str(), output.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  std::remove(input.c_str());
+  std::remove(output.c_str());
+  if (!success) {
+    std::cout << "file::convert failed\n";
+  }
+  return success;
+}
+
+// Converts a .npy file of big endian doubles in Fortran order, whose header is
+// spaced differently from the one NumPy writes, to big endian int16.
+bool test_npy() {
+  namespace npy = clamp_cast::npy;
+  bool success{true};
+  const std::string header{
+      npy::format_header("<f4", false, std::vector<std::size_t>{3, 4})};
+  const std::string dict{"{'descr': '<f4', 'fortran_order': False, 'shape': "
+                         "(3, 4), }"};
+  success &= header.size() % 64 == 0 &&
+             header.compare(0, 10, std::string{"\x93NUMPY\x01\0", 8} +
+                                       static_cast<char>(header.size() - 10) +
+                                       '\0') == 0 &&
+             header.compare(10, dict.size(), dict) == 0 &&
+             header.back() == '\n';
+  success &= npy::format_header("|u1", true, std::vector<std::size_t>{5})
+                 .find("'shape': (5,), }") != std::string::npos;
+  success &= npy::descr<int16_t>(clamp_cast::file::byte_order::big) == ">i2" &&
+             npy::descr<uint8_t>() == "|u1";
+
+  const std::string input{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                          ".npy"};
+  const std::string output{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                           "-out.npy"};
+  const std::vector<double> in{1.5, -40000.0, NAN, 1e6, 32767.0, -2.5};
+  {
+    std::string text{"{\"descr\":\">f8\",\"fortran_order\":True,"
+                     "\"shape\":(2,3)}"};
+    text.append(16 - (10 + text.size() + 1) % 16, ' ');
+    text += '\n';
+    std::ofstream file{input, std::ios::binary};
+    file << std::string{"\x93NUMPY\x01\0", 8}
+         << static_cast<char>(text.size()) << '\0' << text;
+    for (const double value : in) {
+      const auto swapped = clamp_cast::file::detail::byte_swap(value);
+      file.write(reinterpret_cast<const char *>(&swapped), sizeof(swapped));
+    }
+  }
+  clamp_cast::file::options options;
+  options.output_order = clamp_cast::file::byte_order::big;
+  const auto read_output = [&] {
+    const npy::header h{npy::read_header(output.c_str())};
+    success &= h.descr == ">i2" && h.fortran_order &&
+               h.shape == std::vector<std::size_t>{2, 3} &&
+               h.data_offset % 64 == 0;
+    std::vector<int16_t> out(in.size());
+    std::ifstream file{output, std::ios::binary | std::ios::ate};
+    success &= static_cast<size_t>(file.tellg()) ==
+               h.data_offset + out.size() * sizeof(int16_t);
+    file.seekg(static_cast<std::streamoff>(h.data_offset));
+    file.read(reinterpret_cast<char *>(out.data()),
+              static_cast<std::streamsize>(out.size() * sizeof(int16_t)));
+    for (auto &value : out) {
+      value = clamp_cast::file::detail::byte_swap(value);
+    }
+    return out;
+  };
+  const auto result = npy::convert<int16_t>(input.c_str(), output.c_str(),
+                                            options);
+  const auto out = read_output();
+  for (size_t i{0}; i < in.size(); ++i) {
+    success &= out[i] == clamp_cast::clamp_cast<int16_t>(in[i]);
+  }
+  success &= result.values == in.size() &&
+             result.bytes == in.size() * (sizeof(double) + sizeof(int16_t)) &&
+             result.nans == 1 && result.underflows == 1 &&
+             result.overflows == 1;
+  clamp_cast::file::pipeline_options pipeline;
+  pipeline.backend = clamp_cast::file::io::threads;
+  npy::convert_pipelined<int16_t>(input.c_str(), output.c_str(), options,
+                                  pipeline);
+  success &= read_output() == out;
+
+  // Converting a file into itself throws before the input is truncated.
+  try {
+    npy::convert<int16_t>(input.c_str(), input.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  // load ignores the output byte order.
+  const auto loaded = npy::load<int16_t>(input.c_str(), options);
+  success &= loaded.values == out && loaded.header.descr == ">f8" &&
+             loaded.counts.nans == 1;
+
+  // save writes a header that read_header reads back.
+  const std::vector<float> floats{0.5f, 2.5f};
+  npy::save(input.c_str(), floats.data(), std::vector<std::size_t>{2});
+  const npy::header saved{npy::read_header(input.c_str())};
+  success &= saved.descr == npy::descr<float>() && !saved.fortran_order &&
+             saved.shape == std::vector<std::size_t>{2} &&
+             npy::load<int8_t>(input.c_str()).values ==
+                 std::vector<int8_t>{0, 2};
+
+  // Structured dtypes are not supported.
+  std::ofstream{input, std::ios::binary}
+      << npy::format_header("<f4", false, {}).replace(20, 5, "[('a'");
+  try {
+    npy::read_header(input.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  // The number of values of the shape overflows to 0, which would match the
+  // empty payload.
+  std::ofstream{input, std::ios::binary} << npy::format_header(
+      "<f4", false, std::vector<std::size_t>{size_t{1} << 32, size_t{1} << 32});
+  try {
+    npy::convert<int16_t>(input.c_str(), output.c_str());
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+  success &= npy::header{"<f4", false, {3, 0, SIZE_MAX}, 0}.count() == 0;
+  std::remove(input.c_str());
+  std::remove(output.c_str());
+  if (!success) {
+    std::cout << "npy failed\n";
+  }
+  return success;
+}
+#endif
+
+// Converts one analyzed array with blocks in range, of only NaN, only below,
+// only above and mixed values to To.
+template <typename To, typename From>
+bool test_analyzed_type(const std::vector<From> &in,
+                        const clamp_cast::analyzed_buffer<From> &analyzed) {
+  bool success{true};
+  std::vector<To> out(in.size());
+  clamp_cast::saturation_flags flags;
+  clamp_cast::clamp_cast_n(analyzed, out.data(), clamp_cast::sticky{flags});
+  clamp_cast::saturation_flags expected_flags;
+  for (size_t i{0}; i < in.size(); ++i) {
+    const auto expected =
+        clamp_cast::clamp_cast<To>(in[i], clamp_cast::sticky{expected_flags});
+    success &= out[i] == expected;
+  }
+  success &= flags.bits() == expected_flags.bits();
+  return success;
+}
+
+template <typename From> bool test_analyzed_from() {
+  bool success{true};
+  constexpr size_t block{clamp_cast::analyzed_buffer<From>::block_size};
+  const auto values = interesting_values<int32_t, From>();
+  std::vector<From> in(6 * block + 5);
+  for (size_t i{0}; i < in.size(); ++i) {
+    const auto j = static_cast<From>(i % 100);
+    switch (i / block) {
+    case 1:
+      in[i] = NAN;
+      break;
+    case 2:
+      in[i] = From{-0x1p40} - j;
+      break;
+    case 3:
+      in[i] = From{0x1p40} + j;
+      break;
+    case 4:
+      in[i] = values[i % values.size()];
+      break;
+    default:
+      in[i] = j;
+      break;
+    }
+  }
+  const clamp_cast::analyzed_buffer<From> analyzed{in.data(), in.size()};
+  success &= analyzed.blocks().size() == 7;
+  success &= analyzed.blocks()[1].nans == block;
+  success &= analyzed.blocks()[6].minimum == in[6 * block] &&
+             analyzed.blocks()[6].maximum == in.back() &&
+             analyzed.blocks()[6].nans == 0;
+  success &= test_analyzed_type<int8_t>(in, analyzed);
+  success &= test_analyzed_type<uint16_t>(in, analyzed);
+  success &= test_analyzed_type<int32_t>(in, analyzed);
+  success &= test_analyzed_type<uint32_t>(in, analyzed);
+  success &= test_analyzed_type<int64_t>(in, analyzed);
+  success &= test_analyzed_type<uint64_t>(in, analyzed);
+
+  // A throwing policy stops at the first NaN like clamp_cast_n.
+  std::vector<int16_t> out(in.size());
+  try {
+    clamp_cast::clamp_cast_n(
+        analyzed, out.data(),
+        clamp_cast::policy<clamp_cast::report, clamp_cast::report,
+                           clamp_cast::report>{});
+    success = false;
+  } catch (const clamp_cast::conversion_error &) {
+    success &= out[block - 1] == static_cast<int16_t>((block - 1) % 100);
+  }
+  return success;
+}
+
+bool test_analyzed() {
+  bool success{true};
+  success &= test_analyzed_from<float>();
+  success &= test_analyzed_from<double>();
+  success &= test_analyzed_from<long double>();
+  if (!success) {
+    std::cout << "analyzed_buffer failed\n";
+  }
+  return success;
+}
+
+// An executor that runs the chunks in reverse order on the calling thread.
+struct reverse_executor {
+  template <typename F> void for_each_index(const size_t count, F &&f) {
+    for (size_t i{count}; i > 0; --i) {
+      f(i - 1);
+    }
+  }
+};
+
+// Converts several chunks and a partial one on a pool and compares with
+// clamp_cast.
+template <typename To, typename From, typename Executor>
+bool test_parallel_type(Executor &executor) {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  std::vector<From> in(7 * clamp_cast::parallel::chunk_size<From> + 5);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = i % 3 == 0 ? values[i % values.size()]
+                       : static_cast<From>(i % 100);
+  }
+  std::vector<To> out(in.size());
+  clamp_cast::parallel::clamp_cast_n(executor, in.data(), in.size(),
+                                     out.data());
+  for (size_t i{0}; i < in.size(); ++i) {
+    success &= out[i] == clamp_cast::clamp_cast<To>(in[i]);
+  }
+
+  clamp_cast::saturation_flags flags;
+  clamp_cast::parallel::clamp_cast_n<clamp_cast::engine::prescan>(
+      executor, in.data(), in.size(), out.data(), clamp_cast::sticky{flags});
+  clamp_cast::saturation_flags expected_flags;
+  for (size_t i{0}; i < in.size(); ++i) {
+    success &= out[i] == clamp_cast::clamp_cast<To>(
+                             in[i], clamp_cast::sticky{expected_flags});
+  }
+  success &= flags.bits() == expected_flags.bits();
+  return success;
+}
+
+bool test_parallel() {
+  bool success{true};
+  clamp_cast::parallel::thread_pool pool{3};
+  success &= pool.concurrency() == 4;
+  success &= test_parallel_type<int8_t, float>(pool);
+  success &= test_parallel_type<int16_t, float>(pool);
+  success &= test_parallel_type<uint32_t, double>(pool);
+  success &= test_parallel_type<int64_t, double>(pool);
+  reverse_executor reverse;
+  success &= test_parallel_type<int32_t, float>(reverse);
+  success &= test_parallel_type<uint64_t, long double>(reverse);
+
+  // Every index is run exactly once, also when there are fewer than threads.
+  for (const size_t count : {size_t{0}, size_t{1}, size_t{3}, size_t{1000}}) {
+    std::vector<std::atomic<int>> runs(count);
+    pool.for_each_index(count, [&](const size_t i) { ++runs[i]; });
+    for (const auto &r : runs) {
+      success &= r == 1;
+    }
+  }
+
+  std::vector<double> in(100000, 1e300);
+  std::vector<int32_t> out(in.size());
+  clamp_cast::parallel::clamp_cast_n(in.data(), in.size(), out.data());
+  success &= std::all_of(out.begin(), out.end(),
+                         [](const int32_t x) { return x == INT32_MAX; });
+  if (!success) {
+    std::cout << "parallel failed\n";
+  }
+  return success;
+}
+
+// Converts with every execution policy and compares with clamp_cast.
+template <typename ExecutionPolicy>
+bool test_execution_policy(ExecutionPolicy &&execution) {
+  bool success{true};
+  const auto values = interesting_values<int16_t, float>();
+  std::vector<float> in(3 * clamp_cast::parallel::chunk_size<float> + 7);
+  for (size_t i{0}; i < in.size(); ++i) {
+    in[i] = values[i % values.size()];
+  }
+  std::vector<int16_t> out(in.size());
+  clamp_cast::saturation_flags flags;
+  clamp_cast::clamp_cast_n(execution, in.data(), in.size(), out.data(),
+                           clamp_cast::sticky{flags});
+  for (size_t i{0}; i < in.size(); ++i) {
+    success &= out[i] == clamp_cast::clamp_cast<int16_t>(in[i]);
+  }
+  success &= flags.test(clamp_cast::saturation_flags::any);
+  return success;
+}
+
+bool test_execution() {
+  bool success{true};
+  success &= test_execution_policy(clamp_cast::execution::seq);
+  success &= test_execution_policy(clamp_cast::execution::unseq);
+  success &= test_execution_policy(clamp_cast::execution::par);
+  success &= test_execution_policy(clamp_cast::execution::par_unseq);
+#ifdef CLAMP_CAST_STD_EXECUTION
+  success &= test_execution_policy(std::execution::seq);
+  success &= test_execution_policy(std::execution::par);
+  success &= test_execution_policy(std::execution::par_unseq);
+#if __cpp_lib_execution >= 201902L
+  success &= test_execution_policy(std::execution::unseq);
+#endif
+#endif
+  static_assert(!clamp_cast::execution::is_execution_policy<float *>);
+
+  // Sequenced policies allow policies that throw.
+  std::vector<double> in{1.0, 2.0, NAN, 3.0};
+  std::vector<int32_t> out(in.size());
+  try {
+    clamp_cast::clamp_cast_n(
+        clamp_cast::execution::seq, in.data(), in.size(), out.data(),
+        clamp_cast::policy<clamp_cast::report, clamp_cast::report,
+                           clamp_cast::report>{});
+    success = false;
+  } catch (const clamp_cast::conversion_error &) {
+    success &= out[0] == 1 && out[1] == 2;
+  }
+  if (!success) {
+    std::cout << "execution policies failed\n";
+  }
+  return success;
+}
+
+template <typename To, typename From> bool test_tune_convert() {
+  bool success{true};
+  const auto values = interesting_values<To, From>();
+  for (const size_t n : {size_t{0}, values.size(), size_t{20000}}) {
+    std::vector<From> in(n);
+    for (size_t i{0}; i < n; ++i) {
+      in[i] = values[i % values.size()];
+    }
+    std::vector<To> out(n);
+    clamp_cast::tune::clamp_cast_n(in.data(), n, out.data());
+    for (size_t i{0}; i < n; ++i) {
+      success &= out[i] == clamp_cast::clamp_cast<To>(in[i]);
+    }
+  }
+  return success;
+}
+
+// Reading the choices back and calibrating. Without SIMD kernels every pair
+// uses the scalar engine.
+bool test_tune_cache() {
+  namespace tune = clamp_cast::tune;
+  using clamp_cast::engine;
+  bool success{true};
+  const char *path{"clamp-cast-tune-test.txt"};
+
+  // Choices are read from the cache file instead of being measured.
+  {
+    std::ofstream file{path};
+    file << "float int16 scalar simd scalar\nfloat int8 unknown engines\n";
+  }
+  tune::reset();
+  tune::set_cache_file(path);
+  success &= tune::select<int16_t, float>(10) == engine::scalar;
+  success &= tune::select<int16_t, float>(1000) == engine::simd;
+  success &= tune::select<int16_t, float>(100000) == engine::scalar;
+
+  // Calibrating writes the choices to the file for the next process.
+  const auto choice = tune::calibrate<int32_t, double>();
+  tune::reset();
+  tune::set_cache_file(path);
+  for (size_t c{0}; c < tune::size_classes; ++c) {
+    success &= choice[c] != engine::automatic;
+  }
+  success &= tune::select<int32_t, double>(10) == choice[0];
+  success &= tune::select<int32_t, double>(1000) == choice[1];
+  success &= tune::select<int32_t, double>(100000) == choice[2];
+  success &= tune::select<int16_t, float>(1000) == engine::simd;
+
+  tune::reset();
+  std::remove(path);
+  return success;
+}
+
+bool test_tune() {
+  bool success{true};
+  if constexpr (clamp_cast::has_simd_kernel<int16_t, float>()) {
+    success &= test_tune_cache();
+  }
+  // Pairs without a SIMD kernel are measured too because of prescan.
+  success &= clamp_cast::tune::select<int64_t, double>(1000) !=
+             clamp_cast::engine::automatic;
+
+  // Calibrating on a sample of the input, here one that clips half of the
+  // time.
+  const std::vector<float> sample{0.5f, 1e9f, -3.0f, -1e9f, NAN, 7.0f};
+  const auto choice =
+      clamp_cast::tune::calibrate<int32_t>(sample.data(), sample.size());
+  for (size_t c{0}; c < clamp_cast::tune::size_classes; ++c) {
+    success &= choice[c] != clamp_cast::engine::automatic;
+  }
+  success &= clamp_cast::tune::select<int32_t, float>(1000) == choice[1];
+  try {
+    clamp_cast::tune::calibrate<int32_t>(sample.data(), 0);
+    success = false;
+  } catch (const std::invalid_argument &) {
+  }
+
+  success &= test_tune_convert<int8_t, float>();
+  success &= test_tune_convert<uint16_t, float>();
+  success &= test_tune_convert<int32_t, double>();
+  success &= test_tune_convert<uint64_t, double>();
+  if (!success) {
+    std::cout << "tune failed\n";
+  }
+  return success;
+}
+
+#ifdef CLAMP_CAST_TELEMETRY
+bool test_telemetry() {
+  const auto convert = [](const float from) {
+    return clamp_cast::clamp_cast<int8_t>(from);
+  };
+  const unsigned line{__LINE__ - 2};
+  for (const float from : {1.0f, 1.5f, 1000.0f, -1000.0f, NAN, NAN}) {
+    convert(from);
+  }
+  const std::vector<float> values{1.0f, 2.0f, NAN};
+  std::vector<int8_t> out(values.size());
+  clamp_cast::clamp_cast_n(values.data(), values.size(), out.data());
+  const unsigned line_n{__LINE__ - 1};
+  // Only the values that fit into the ring are converted and counted.
+  const std::vector<float> pushed{1000.0f, 1.0f, NAN};
+  clamp_cast::conversion_ring<int8_t, float> ring{2};
+  ring.push(pushed.data(), pushed.size());
+  const unsigned line_ring{__LINE__ - 1};
+
+  bool success{true};
+  bool found{false};
+  bool found_n{false};
+  bool found_ring{false};
+  for (const auto &site : clamp_cast::telemetry::snapshot()) {
+    if (site.file != __FILE__) {
+      // The library must not record its internal calls.
+      std::cout << "unexpected site " << site.file << "\n";
+      success = false;
+    } else if (site.line == line) {
+      found = true;
+      success &= site.counts ==
+                 clamp_cast::telemetry::status_counts{1, 1, 1, 1, 2};
+    } else if (site.line == line_n) {
+      found_n = true;
+      success &= site.counts ==
+                 clamp_cast::telemetry::status_counts{2, 0, 0, 0, 1};
+    } else if (site.line == line_ring) {
+      found_ring = true;
+      success &= site.counts ==
+                 clamp_cast::telemetry::status_counts{1, 0, 0, 1, 0};
+    }
+  }
+  return success && found && found_n && found_ring;
+}
+
+#ifdef __linux__
+// Registers dump_at_exit in a child process before its first conversion,
+// which builds the registry after the handler is registered, and checks what
+// the handler prints at exit.
+bool test_telemetry_at_exit() {
+  const std::string path{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                         ".txt"};
+  const pid_t child{fork()};
+  if (child == 0) {
+    if (std::freopen(path.c_str(), "w", stderr) == nullptr) {
+      _exit(1);
+    }
+    clamp_cast::telemetry::dump_at_exit();
+    volatile float from{1e9f};
+    clamp_cast::clamp_cast<int16_t>(from);
+    std::exit(0);
+  }
+  int status{0};
+  bool success{child > 0 && waitpid(child, &status, 0) == child &&
+               WIFEXITED(status) && WEXITSTATUS(status) == 0};
+  std::ifstream file{path};
+  const std::string dump{std::istreambuf_iterator<char>{file},
+                         std::istreambuf_iterator<char>{}};
+  success &= dump.find("saturated_high=1") != std::string::npos;
+  std::remove(path.c_str());
+  if (!success) {
+    std::cout << "telemetry::dump_at_exit failed\n";
+  }
+  return success;
+}
+#endif
+#endif
+
+#ifdef CLAMP_CAST_PROFILE
+bool test_profile() {
+  namespace profile = clamp_cast::profile;
+  profile::set_sampling_interval(1);
+  profile::reset();
+  const std::vector<float> values{NAN,   0.0f,    -0.0f,  1.0f,     100.0f,
+                                  127.0f, 128.0f, 1e9f,  INFINITY, -128.0f,
+                                  -1.0f, -1e9f};
+  std::vector<int8_t> out(values.size());
+  clamp_cast::clamp_cast_n(values.data(), values.size(), out.data());
+
+  bool success{true};
+  bool found{false};
+  for (const auto &pair : profile::snapshot()) {
+    if (pair.to != "int8" || pair.from != "float") {
+      continue;
+    }
+    found = true;
+    const auto bucket = [](const auto &histogram, const int e) {
+      return histogram[static_cast<size_t>(e - profile::min_exponent)];
+    };
+    success &= pair.samples == values.size() && pair.nan == 1 &&
+               pair.zero == 2;
+    // The bound is 2**7.
+    success &= bucket(pair.positive, -7) == 1;
+    success &= bucket(pair.positive, -1) == 2;
+    success &= bucket(pair.positive, 0) == 1;
+    success &= bucket(pair.positive, 22) == 1;
+    success &= bucket(pair.positive, profile::max_exponent) == 1;
+    success &= bucket(pair.negative, 0) == 1;
+    success &= bucket(pair.negative, -7) == 1;
+    success &= bucket(pair.negative, 22) == 1;
+  }
+  profile::set_sampling_interval(64);
+  return success && found;
+}
+
+#ifdef __linux__
+// Registers write_json_at_exit in a child process before its first profiled
+// conversion and checks the JSON that the handler writes at exit.
+bool test_profile_at_exit() {
+  const std::string path{"/tmp/clamp-cast-test-" + std::to_string(getpid()) +
+                         ".json"};
+  const pid_t child{fork()};
+  if (child == 0) {
+    clamp_cast::profile::write_json_at_exit(path);
+    clamp_cast::profile::set_sampling_interval(1);
+    const std::vector<double> values{1.0, NAN, 3.0};
+    std::vector<uint16_t> out(values.size());
+    clamp_cast::clamp_cast_n(values.data(), values.size(), out.data());
+    std::exit(0);
+  }
+  int status{0};
+  bool success{child > 0 && waitpid(child, &status, 0) == child &&
+               WIFEXITED(status) && WEXITSTATUS(status) == 0};
+  std::ifstream file{path};
+  const std::string json{std::istreambuf_iterator<char>{file},
+                         std::istreambuf_iterator<char>{}};
+  success &= json.find("\"to\": \"uint16\", \"from\": \"double\", "
+                       "\"samples\": 3, \"nan\": 1") != std::string::npos;
+  std::remove(path.c_str());
+  if (!success) {
+    std::cout << "profile::write_json_at_exit failed\n";
+  }
+  return success;
+}
+#endif
+#endif
+
 int main() {
-  if (test()) {
+  bool success{true};
+#if defined(CLAMP_CAST_TELEMETRY) && defined(__linux__)
+  // First, before any conversion builds the registry.
+  success &= test_telemetry_at_exit();
+#endif
+#if defined(CLAMP_CAST_PROFILE) && defined(__linux__)
+  success &= test_profile_at_exit();
+#endif
+  success &= test();
+  success &= test_compare();
+  success &= test_interval();
+  success &= test_policy();
+  success &= test_checked();
+  success &= test_sticky();
+  success &= test_prescan();
+  success &= test_adaptive();
+  success &= test_streaming();
+  success &= test_analyzed();
+  success &= test_stream();
+  success &= test_ring();
+#ifdef __linux__
+  success &= test_shared_channel();
+  success &= test_file();
+  success &= test_npy();
+#endif
+  success &= test_parallel();
+  success &= test_execution();
+  success &= test_tune();
+#ifdef CLAMP_CAST_TELEMETRY
+  success &= test_telemetry();
+#endif
+#ifdef CLAMP_CAST_PROFILE
+  success &= test_profile();
+#endif
+  if (success) {
     std::cout << "no errors\n";
     return 0;
   } else {
@@ -0,0 +1,354 @@
+// Verifies clamp_cast and the bulk kernels against a reference that converts
+// with exact integer arithmetic on the bits of the value. All 2^32 float values
+// are checked for every integer type on all cores. Doubles cannot be
+// enumerated so values near the bounds of every integer type, near powers of
+// 2 and random values are checked instead. Compile with optimizations, for
+// example with ./compile-and-verify.sh . An optional argument n only checks
+// every n-th float to make the sweep faster.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "clamp-cast-bulk.hpp"
+#include "clamp-cast.hpp"
+
+// The exact value of a float as sign, integer part and whether there is a
+// fractional part. Integer parts that do not fit into 64 bits and infinities
+// are huge.
+struct decoded {
+  bool nan;
+  bool negative;
+  bool huge;
+  uint64_t integer;
+  bool fraction;
+};
+
+template <typename From> decoded decode(const From from) {
+  using bits_type = std::conditional_t<sizeof(From) == 4, uint32_t, uint64_t>;
+  static_assert(sizeof(From) == sizeof(bits_type));
+  constexpr int mantissa_bits{std::numeric_limits<From>::digits - 1};
+  constexpr int exponent_bits{int{sizeof(From)} * 8 - 1 - mantissa_bits};
+  constexpr int bias{std::numeric_limits<From>::max_exponent - 1};
+  bits_type bits;
+  std::memcpy(&bits, &from, sizeof(bits));
+  const uint64_t mantissa_field{bits & ((bits_type{1} << mantissa_bits) - 1)};
+  const int exponent_field{
+      static_cast<int>((bits >> mantissa_bits) &
+                       ((bits_type{1} << exponent_bits) - 1))};
+
+  decoded d{};
+  d.negative = (bits >> (sizeof(From) * 8 - 1)) != 0;
+  if (exponent_field == (1 << exponent_bits) - 1) {
+    d.nan = mantissa_field != 0;
+    d.huge = true;
+    return d;
+  }
+  // The value is mantissa * 2^exponent.
+  uint64_t mantissa{mantissa_field};
+  int exponent{1 - bias - mantissa_bits};
+  if (exponent_field != 0) {
+    mantissa |= uint64_t{1} << mantissa_bits;
+    exponent = exponent_field - bias - mantissa_bits;
+  }
+  if (exponent >= 64) {
+    d.huge = true;
+  } else if (exponent > 0) {
+    d.huge = (mantissa >> (64 - exponent)) != 0;
+    d.integer = mantissa << exponent;
+  } else if (exponent > -64) {
+    d.integer = mantissa >> -exponent;
+    d.fraction = (mantissa & ((uint64_t{1} << -exponent) - 1)) != 0;
+  } else {
+    d.fraction = mantissa != 0;
+  }
+  return d;
+}
+
+// What checked_clamp_cast should return, computed without floating point
+// arithmetic.
+template <typename To, typename From>
+clamp_cast::checked_result<To> reference(const From from) {
+  using clamp_cast::conversion_status;
+  using limits = std::numeric_limits<To>;
+  const auto d = decode(from);
+  const auto in_range = d.fraction ? conversion_status::truncated
+                                   : conversion_status::exact;
+  if (d.nan) {
+    return {0, conversion_status::nan};
+  } else if (d.negative && (d.huge || d.integer != 0 || d.fraction)) {
+    if constexpr (!limits::is_signed) {
+      return {0, conversion_status::saturated_low};
+    } else {
+      const uint64_t magnitude{uint64_t{1} << limits::digits};
+      if (d.huge || d.integer > magnitude ||
+          (d.integer == magnitude && d.fraction)) {
+        return {limits::min(), conversion_status::saturated_low};
+      } else if (d.integer == magnitude) {
+        return {limits::min(), in_range};
+      } else {
+        return {static_cast<To>(-static_cast<int64_t>(d.integer)), in_range};
+      }
+    }
+  } else if (d.huge || d.integer > static_cast<uint64_t>(limits::max())) {
+    return {limits::max(), conversion_status::saturated_high};
+  } else {
+    return {static_cast<To>(d.integer), in_range};
+  }
+}
+
+std::mutex output_mutex;
+std::atomic<uint64_t> mismatches{0};
+
+template <typename To, typename From>
+void mismatch(const char *engine, const From from, const To expected,
+              const To actual) {
+  if (mismatches++ < 20) {
+    std::lock_guard<std::mutex> lock{output_mutex};
+    std::cerr << engine << " " << clamp_cast::detail::type_name<From>()
+              << " -> " << clamp_cast::detail::type_name<To>() << " "
+              << std::hexfloat << from << std::defaultfloat << ": expected "
+              << +expected << " got " << +actual << "\n";
+  }
+}
+
+// Converts the values with every engine and compares with the reference.
+template <typename To, typename From> class verification {
+public:
+  explicit verification(const std::vector<From> &in)
+      : in_{in}, n_{in.size()}, expected_(n_), out_(n_),
+        selection_((n_ + 63) / 64) {
+    for (size_t i{0}; i < n_; ++i) {
+      expected_[i] = reference<To>(in_[i]);
+    }
+  }
+
+  void run() {
+    for (size_t i{0}; i < n_; ++i) {
+      const auto actual = clamp_cast::clamp_cast<To>(in_[i]);
+      if (actual != expected_[i].value) {
+        mismatch("clamp_cast", in_[i], expected_[i].value, actual);
+      }
+      const auto checked = clamp_cast::checked_clamp_cast<To>(in_[i]);
+      if (checked.value != expected_[i].value ||
+          checked.status != expected_[i].status) {
+        mismatch("checked_clamp_cast", in_[i], expected_[i].value,
+                 checked.value);
+      }
+    }
+    run_engine<clamp_cast::engine::scalar>("scalar");
+    run_engine<clamp_cast::engine::simd>("simd");
+    run_engine<clamp_cast::engine::prescan>("prescan");
+  }
+
+private:
+  void compare_out(const char *engine) {
+    for (size_t i{0}; i < n_; ++i) {
+      if (out_[i] != expected_[i].value) {
+        mismatch(engine, in_[i], expected_[i].value, out_[i]);
+      }
+    }
+  }
+
+  template <clamp_cast::engine Engine> void run_engine(const char *name) {
+    using clamp_cast::conversion_status;
+    const std::string engine{name};
+
+    clamp_cast::clamp_cast_n<Engine>(in_.data(), n_, out_.data());
+    compare_out(("clamp_cast_n/" + engine).c_str());
+
+    clamp_cast::saturation_flags flags;
+    clamp_cast::clamp_cast_n<Engine>(in_.data(), n_, out_.data(),
+                                     clamp_cast::sticky{flags});
+    compare_out(("clamp_cast_n/sticky/" + engine).c_str());
+    unsigned expected_flags{0};
+    for (const auto &e : expected_) {
+      expected_flags |=
+          e.status == conversion_status::nan ? clamp_cast::saturation_flags::nan
+          : e.status == conversion_status::saturated_low
+              ? clamp_cast::saturation_flags::underflow
+          : e.status == conversion_status::saturated_high
+              ? clamp_cast::saturation_flags::overflow
+              : 0u;
+    }
+    if (flags.bits() != expected_flags) {
+      std::lock_guard<std::mutex> lock{output_mutex};
+      ++mismatches;
+      std::cerr << "sticky flags " << engine << " "
+                << clamp_cast::detail::type_name<From>() << " -> "
+                << clamp_cast::detail::type_name<To>() << ": expected "
+                << expected_flags << " got " << flags.bits() << "\n";
+    }
+
+    const auto summary = clamp_cast::checked_clamp_cast_n<Engine>(
+        in_.data(), n_, out_.data(), selection_.data());
+    compare_out(("checked_clamp_cast_n/" + engine).c_str());
+    size_t count{0};
+    for (size_t i{0}; i < n_; ++i) {
+      const bool saturated{expected_[i].status != conversion_status::exact &&
+                           expected_[i].status != conversion_status::truncated};
+      count += saturated;
+      if (((selection_[i / 64] >> (i % 64)) & 1) != saturated) {
+        mismatch(("checked_clamp_cast_n/selection/" + engine).c_str(), in_[i],
+                 expected_[i].value, out_[i]);
+      }
+    }
+    if (summary.count != count) {
+      std::lock_guard<std::mutex> lock{output_mutex};
+      ++mismatches;
+      std::cerr << "checked_clamp_cast_n summary " << engine << ": expected "
+                << count << " got " << summary.count << "\n";
+    }
+  }
+
+  const std::vector<From> &in_;
+  const size_t n_;
+  std::vector<clamp_cast::checked_result<To>> expected_;
+  std::vector<To> out_;
+  std::vector<uint64_t> selection_;
+};
+
+template <typename From> void verify_all(const std::vector<From> &in) {
+  verification<int8_t, From>{in}.run();
+  verification<uint8_t, From>{in}.run();
+  verification<int16_t, From>{in}.run();
+  verification<uint16_t, From>{in}.run();
+  verification<int32_t, From>{in}.run();
+  verification<uint32_t, From>{in}.run();
+  verification<int64_t, From>{in}.run();
+  verification<uint64_t, From>{in}.run();
+}
+
+// Verifies chunks of values made by generate(chunk, values) on all cores.
+template <typename From, typename Generate>
+void sweep(const char *name, const size_t chunks, Generate generate) {
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+  const auto work = [&] {
+    std::vector<From> values;
+    while (true) {
+      const size_t chunk{next++};
+      if (chunk >= chunks) {
+        break;
+      }
+      generate(chunk, values);
+      verify_all(values);
+      const size_t finished{++done};
+      if (finished * 10 / chunks != (finished - 1) * 10 / chunks) {
+        std::lock_guard<std::mutex> lock{output_mutex};
+        std::cerr << name << ": " << finished * 100 / chunks << "%\n";
+      }
+    }
+  };
+  std::vector<std::thread> threads(
+      std::max(1u, std::thread::hardware_concurrency()));
+  for (auto &thread : threads) {
+    thread = std::thread{work};
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+constexpr size_t chunk_size{size_t{1} << 16};
+
+// Checks every stride-th of the 2^32 float bit patterns.
+void sweep_float(const uint64_t stride) {
+  const uint64_t patterns{(uint64_t{1} << 32) / stride};
+  const auto generate = [&](const size_t chunk, std::vector<float> &values) {
+    const uint64_t begin{chunk * chunk_size};
+    values.resize(std::min<uint64_t>(chunk_size, patterns - begin));
+    for (size_t i{0}; i < values.size(); ++i) {
+      const auto bits = static_cast<uint32_t>((begin + i) * stride);
+      std::memcpy(&values[i], &bits, sizeof(bits));
+    }
+  };
+  sweep<float>("float", (patterns + chunk_size - 1) / chunk_size, generate);
+}
+
+// Adds value and -value to seeds.
+template <typename T>
+void add_seeds(std::vector<double> &seeds, const T value) {
+  seeds.push_back(static_cast<double>(value));
+  seeds.push_back(-static_cast<double>(value));
+}
+
+template <typename To> void add_bounds(std::vector<double> &seeds) {
+  add_seeds(seeds, std::numeric_limits<To>::min());
+  add_seeds(seeds, std::numeric_limits<To>::max());
+  add_seeds(seeds, clamp_cast::lower_bound_inclusive<To, double>());
+  add_seeds(seeds, clamp_cast::upper_bound_exclusive<To, double>());
+}
+
+// Checks doubles within 64 ULP of the bounds of every integer type, of powers
+// of 2 and of small integers together with random bit patterns and random
+// values of every magnitude.
+void sweep_double(const size_t chunks) {
+  std::vector<double> seeds{0.0, -0.0, INFINITY, -INFINITY};
+  add_bounds<int8_t>(seeds);
+  add_bounds<uint8_t>(seeds);
+  add_bounds<int16_t>(seeds);
+  add_bounds<uint16_t>(seeds);
+  add_bounds<int32_t>(seeds);
+  add_bounds<uint32_t>(seeds);
+  add_bounds<int64_t>(seeds);
+  add_bounds<uint64_t>(seeds);
+  for (int exponent{-1074}; exponent <= 1023; ++exponent) {
+    add_seeds(seeds, std::ldexp(1.0, exponent));
+  }
+  for (int i{1}; i <= 256; ++i) {
+    add_seeds(seeds, i);
+  }
+
+  sweep<double>(
+      "double", chunks, [&](const size_t chunk, std::vector<double> &values) {
+        std::mt19937_64 rng{chunk};
+        std::uniform_int_distribution<size_t> seed{0, seeds.size() - 1};
+        std::uniform_int_distribution<int64_t> ulps{-64, 64};
+        std::uniform_int_distribution<int> exponent{-70, 70};
+        std::uniform_real_distribution<double> unit{-1, 1};
+        values.resize(chunk_size);
+        for (size_t i{0}; i < values.size(); ++i) {
+          if (i % 4 < 2) {
+            // Step the magnitude by ULPs while keeping the sign.
+            uint64_t bits;
+            std::memcpy(&bits, &seeds[seed(rng)], sizeof(bits));
+            const uint64_t sign{bits & (uint64_t{1} << 63)};
+            const auto magnitude = static_cast<int64_t>(bits ^ sign);
+            bits = sign | static_cast<uint64_t>(
+                              std::max<int64_t>(0, magnitude + ulps(rng)));
+            std::memcpy(&values[i], &bits, sizeof(bits));
+          } else if (i % 4 == 2) {
+            const uint64_t bits{rng()};
+            std::memcpy(&values[i], &bits, sizeof(bits));
+          } else {
+            values[i] = std::ldexp(unit(rng), exponent(rng));
+          }
+        }
+      });
+}
+
+int main(int argc, char **argv) {
+  const uint64_t stride{argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1};
+  if (stride == 0) {
+    std::cerr << "usage: " << argv[0] << " [stride]\n";
+    return 2;
+  }
+  sweep_float(stride);
+  sweep_double(size_t{1} << 10);
+  if (mismatches != 0) {
+    std::cerr << mismatches << " mismatches\n";
+    return 1;
+  }
+  std::cerr << "no errors\n";
+}